@@ -2,14 +2,70 @@
 
 #include <glm/gtx/component_wise.hpp>
 
+#include <stdexcept>
+
+
+void Collider::use_tile_grid(glm::vec2 origin, glm::vec2 tile_size, glm::ivec2 dims)
+{
+    // cell_of divides by the tile size
+    if (!(tile_size.x > 0.f && tile_size.y > 0.f)) {
+        throw std::runtime_error("Tile grid needs a positive tile size.");
+    }
+    mode = TILE_GRID;
+    grid.origin = origin;
+    grid.tile_size = tile_size;
+    grid.dims = glm::max(dims, glm::ivec2(0));
+    grid.cells.assign(size_t(grid.dims.x) * size_t(grid.dims.y), 0U);
+
+    for (auto &box : map_components) {
+        rasterize(box);
+    }
+    map_components.clear();
+}
+
+void Collider::set_tile(glm::ivec2 cell, uint8_t value)
+{
+    if (cell.x < 0 || cell.y < 0 || cell.x >= grid.dims.x || cell.y >= grid.dims.y) return;
+    grid.cells[cell.y * grid.dims.x + cell.x] = value;
+}
+
+void Collider::rasterize(AABB const &box)
+{
+    // a cell is solid if the box overlaps it at all, so boxes smaller than a tile or off the grid lines keep
+    // their collision; a box edge exactly on a grid line doesn't claim the cell beyond it
+    glm::vec2 lo = glm::floor((box.upperleft - grid.origin) / grid.tile_size);
+    glm::vec2 hi = glm::ceil((box.lowerright - grid.origin) / grid.tile_size) - 1.f;
+    hi = glm::max(hi, lo);  // zero-size boxes still mark the cell they are in
+
+    // clamp to the grid while still in floats, so huge or far-off boxes neither overflow ints nor loop over
+    // cells that don't exist
+    lo = glm::max(lo, glm::vec2(0.f));
+    hi = glm::min(hi, glm::vec2(grid.dims - 1));
+    if (!(lo.x <= hi.x && lo.y <= hi.y)) return;
+    glm::ivec2 first = glm::ivec2(lo);
+    glm::ivec2 last = glm::ivec2(hi);
+    for (int y = first.y; y <= last.y; ++y) {
+        for (int x = first.x; x <= last.x; ++x) {
+            set_tile(glm::ivec2(x, y));
+        }
+    }
+}
 
 void Collider::add_component(glm::vec2 center, glm::vec2 size)
 {
+    if (mode == TILE_GRID) {
+        rasterize(AABB(center - size / 2.f, center + size / 2.f));
+        return;
+    }
     map_components.emplace_back(center - size / 2.f, center + size / 2.f);
 }
 
 std::pair<bool, glm::vec2> Collider::solve_collision(glm::vec2 center, glm::vec2 size)
 {
+    if (mode == TILE_GRID) {
+        return solve_collision_grid(center, size);
+    }
+
     glm::vec2 upperleft = center - size / 2.f;
     glm::vec2 lowerright = center + size / 2.f;
 
@@ -25,3 +81,65 @@ std::pair<bool, glm::vec2> Collider::solve_collision(glm::vec2 center, glm::vec2
     }
     return std::make_pair(false, glm::vec2(0.f));
 }
+
+std::pair<bool, glm::vec2> Collider::solve_collision_grid(glm::vec2 center, glm::vec2 size) const
+{
+    glm::vec2 upperleft = center - size / 2.f;
+    glm::vec2 lowerright = center + size / 2.f;
+
+    // only the cells under the query box need to be looked at, which is constant for a fixed size
+    glm::ivec2 first = glm::max(grid.cell_of(upperleft), glm::ivec2(0));
+    glm::ivec2 last = glm::min(grid.cell_of(lowerright), grid.dims - 1);
+
+    for (int y = first.y; y <= last.y; ++y) {
+        for (int x = first.x; x <= last.x; ++x) {
+            if (!grid.at(glm::ivec2(x, y))) continue;
+
+            // Sweep along the occupied cells from the hit one and grow them into a solid rectangle, so that
+            // a floor or a wall made of many tiles resolves like the single box it represents instead of
+            // snagging on seams. The sweep stays within one cell of the query box; further cells can't
+            // change the overlap.
+            glm::ivec2 lo = first - 1, hi = last + 1;
+            auto solid_span = [this](glm::ivec2 from, glm::ivec2 to) {
+                for (int sy = from.y; sy <= to.y; ++sy) {
+                    for (int sx = from.x; sx <= to.x; ++sx) {
+                        if (!grid.at(glm::ivec2(sx, sy))) return false;
+                    }
+                }
+                return true;
+            };
+            auto grow = [&](bool rows_first) {
+                glm::ivec2 rmin(x, y), rmax(x, y);
+                for (int pass = 0; pass < 2; ++pass) {
+                    if ((pass == 0) == rows_first) {
+                        while (rmin.x > lo.x && solid_span(glm::ivec2(rmin.x - 1, rmin.y), glm::ivec2(rmin.x - 1, rmax.y))) --rmin.x;
+                        while (rmax.x < hi.x && solid_span(glm::ivec2(rmax.x + 1, rmin.y), glm::ivec2(rmax.x + 1, rmax.y))) ++rmax.x;
+                    } else {
+                        while (rmin.y > lo.y && solid_span(glm::ivec2(rmin.x, rmin.y - 1), glm::ivec2(rmax.x, rmin.y - 1))) --rmin.y;
+                        while (rmax.y < hi.y && solid_span(glm::ivec2(rmin.x, rmax.y + 1), glm::ivec2(rmax.x, rmax.y + 1))) ++rmax.y;
+                    }
+                }
+                return std::make_pair(rmin, rmax);
+            };
+            auto horizontal = grow(true);
+            auto vertical = grow(false);
+            auto area = [](std::pair<glm::ivec2, glm::ivec2> const &r) {
+                return (r.second.x - r.first.x + 1) * (r.second.y - r.first.y + 1);
+            };
+            auto const &run = area(horizontal) >= area(vertical) ? horizontal : vertical;
+            AABB box(
+                grid.origin + glm::vec2(run.first) * grid.tile_size,
+                grid.origin + glm::vec2(run.second + 1) * grid.tile_size
+            );
+
+            glm::vec2 overlap = size + (box.lowerright - box.upperleft) -
+                (glm::max(lowerright, box.lowerright) - glm::min(upperleft, box.upperleft));
+            if (overlap.x >= 0 && overlap.y >= 0) {
+                glm::vec2 box_center = (box.upperleft + box.lowerright) / 2.f;
+                glm::vec2 resolve_vec = glm::sign(center - box_center) * overlap;
+                return std::make_pair(true, resolve_vec);
+            }
+        }
+    }
+    return std::make_pair(false, glm::vec2(0.f));
+}
@@ -2,6 +2,7 @@
 
 #include <glm/glm.hpp>
 #include <vector>
+#include <cstdint>
 
 
 class Collider {
@@ -12,9 +13,47 @@ public:
         AABB(glm::vec2 upperleft, glm::vec2 lowerright): upperleft(upperleft), lowerright(lowerright) {}
     };
 
+    // how map components are stored
+    enum Mode {
+        AABB_LIST = 0,  // every component is kept as a box and tested one by one
+        TILE_GRID,      // components are rasterized into a dense grid, one byte per cell
+    };
+
+    // dense map storage for TILE_GRID mode
+    struct TileGrid {
+        glm::vec2 origin = glm::vec2(0.f);  // upper left corner of cell (0, 0)
+        glm::vec2 tile_size = glm::vec2(1.f);
+        glm::ivec2 dims = glm::ivec2(0);  // width, height in cells
+        std::vector<uint8_t> cells;  // row major, 0 means empty
+
+        uint8_t at(glm::ivec2 cell) const {
+            if (cell.x < 0 || cell.y < 0 || cell.x >= dims.x || cell.y >= dims.y) return 0U;
+            return cells[cell.y * dims.x + cell.x];
+        }
+        // cell containing a world position (may be out of the grid)
+        glm::ivec2 cell_of(glm::vec2 position) const {
+            return glm::ivec2(glm::floor((position - origin) / tile_size));
+        }
+    };
+
+    Mode mode = AABB_LIST;
+
     std::vector<AABB> map_components;
+    TileGrid grid;
+
+    // switch to TILE_GRID mode with an empty grid; existing boxes are rasterized into it
+    // (throws if tile_size is not positive)
+    void use_tile_grid(glm::vec2 origin, glm::vec2 tile_size, glm::ivec2 dims);
+
+    // set a single grid cell, 0 clears it
+    void set_tile(glm::ivec2 cell, uint8_t value = 1U);
 
     void add_component(glm::vec2 center, glm::vec2 size);
 
     std::pair<bool, glm::vec2> solve_collision(glm::vec2 center, glm::vec2 size);
+
+private:
+    void rasterize(AABB const &box);
+
+    std::pair<bool, glm::vec2> solve_collision_grid(glm::vec2 center, glm::vec2 size) const;
 };
@@ -6,12 +6,90 @@
 
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <cstring>
+
 //All DrawLines instances share a vertex array object and vertex buffer, initialized at load time:
 
 //n.b. declared static so they don't conflict with similarly named global variables elsewhere:
 static GLuint vertex_buffer = 0;
 static GLuint vertex_buffer_for_color_program = 0;
 
+//vertex_buffer is a streaming buffer that is only reallocated to grow:
+// each DrawLines appends its vertices after the previous one's, and the buffer is orphaned when it wraps
+static size_t vertex_buffer_capacity = 0; //in vertices
+static size_t vertex_buffer_head = 0; //first vertex not yet written since the last orphaning
+
+//vertex storage arena: vectors handed back by finished DrawLines keep their capacity for the next ones
+static std::vector< std::vector< DrawLines::Vertex > > &spare_attribs() {
+	static std::vector< std::vector< DrawLines::Vertex > > spare;
+	return spare;
+}
+
+//vertex array object describing arrays of DrawLines::Vertex in buffer, for color_program:
+static GLuint make_vertex_array(GLuint buffer) {
+	//ask OpenGL to fill vertex_array with the name of an unused vertex array object:
+	GLuint vertex_array = 0;
+	glGenVertexArrays(1, &vertex_array);
+
+	//set vertex_array as the current vertex array object:
+	glBindVertexArray(vertex_array);
+
+	//set buffer as the source of glVertexAttribPointer() commands:
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+	//set up the vertex array object to describe arrays of PongMode::Vertex:
+	glVertexAttribPointer(
+		color_program->Position_vec4, //attribute
+		3, //size
+		GL_FLOAT, //type
+		GL_FALSE, //normalized
+		sizeof(DrawLines::Vertex), //stride
+		(GLbyte *)0 + offsetof(DrawLines::Vertex, Position) //offset
+	);
+	glEnableVertexAttribArray(color_program->Position_vec4);
+	//[Note that it is okay to bind a vec3 input to a vec4 attribute -- the w component will be filled with 1.0 automatically]
+
+	glVertexAttribPointer(
+		color_program->Color_vec4, //attribute
+		4, //size
+		GL_UNSIGNED_BYTE, //type
+		GL_TRUE, //normalized
+		sizeof(DrawLines::Vertex), //stride
+		(GLbyte *)0 + offsetof(DrawLines::Vertex, Color) //offset
+	);
+	glEnableVertexAttribArray(color_program->Color_vec4);
+
+	//done referring to buffer, so unbind it:
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	//done setting up vertex array object, so unbind it:
+	glBindVertexArray(0);
+
+	return vertex_array;
+}
+
+//draw count vertices starting at first through vertex_array:
+static void draw_lines(GLuint vertex_array, glm::mat4 const &world_to_clip, GLint first, GLsizei count) {
+	//set color_program as current program:
+	glUseProgram(color_program->program);
+
+	//upload OBJECT_TO_CLIP to the proper uniform location:
+	glUniformMatrix4fv(color_program->OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(world_to_clip));
+
+	//use the mapping vertex_array to fetch vertex data:
+	glBindVertexArray(vertex_array);
+
+	//run the OpenGL pipeline:
+	glDrawArrays(GL_LINES, first, count);
+
+	//reset vertex array to none:
+	glBindVertexArray(0);
+
+	//reset current program to none:
+	glUseProgram(0);
+}
+
 static Load< void > setup_buffers(LoadTagDefault, [](){
 	//you may recognize this init code from DrawSprites.cpp:
 
@@ -21,42 +99,7 @@ static Load< void > setup_buffers(LoadTagDefault, [](){
 	}
 
 	{ //vertex array mapping buffer for color_program:
-		//ask OpenGL to fill vertex_buffer_for_color_program with the name of an unused vertex array object:
-		glGenVertexArrays(1, &vertex_buffer_for_color_program);
-
-		//set vertex_buffer_for_color_program as the current vertex array object:
-		glBindVertexArray(vertex_buffer_for_color_program);
-
-		//set vertex_buffer as the source of glVertexAttribPointer() commands:
-		glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
-
-		//set up the vertex array object to describe arrays of PongMode::Vertex:
-		glVertexAttribPointer(
-			color_program->Position_vec4, //attribute
-			3, //size
-			GL_FLOAT, //type
-			GL_FALSE, //normalized
-			sizeof(DrawLines::Vertex), //stride
-			(GLbyte *)0 + offsetof(DrawLines::Vertex, Position) //offset
-		);
-		glEnableVertexAttribArray(color_program->Position_vec4);
-		//[Note that it is okay to bind a vec3 input to a vec4 attribute -- the w component will be filled with 1.0 automatically]
-
-		glVertexAttribPointer(
-			color_program->Color_vec4, //attribute
-			4, //size
-			GL_UNSIGNED_BYTE, //type
-			GL_TRUE, //normalized
-			sizeof(DrawLines::Vertex), //stride
-			(GLbyte *)0 + offsetof(DrawLines::Vertex, Color) //offset
-		);
-		glEnableVertexAttribArray(color_program->Color_vec4);
-
-		//done referring to vertex_buffer, so unbind it:
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-		//done setting up vertex array object, so unbind it:
-		glBindVertexArray(0);
+		vertex_buffer_for_color_program = make_vertex_array(vertex_buffer);
 	}
 
 	GL_ERRORS(); //PARANOIA: make sure nothing strange happened during setup
@@ -64,14 +107,20 @@ static Load< void > setup_buffers(LoadTagDefault, [](){
 
 
 DrawLines::DrawLines(glm::mat4 const &world_to_clip_) : world_to_clip(world_to_clip_) {
+	//take storage from the arena, so lines drawn every frame don't allocate:
+	auto &spare = spare_attribs();
+	if (!spare.empty()) {
+		attribs.swap(spare.back());
+		spare.pop_back();
+	}
 }
 
-void DrawLines::draw(glm::vec3 const &a, glm::vec3 const &b, glm::u8vec4 const &color) {
+void LineRecorder::draw(glm::vec3 const &a, glm::vec3 const &b, glm::u8vec4 const &color) {
 	attribs.emplace_back(a, color);
 	attribs.emplace_back(b, color);
 }
 
-void DrawLines::draw_box(glm::mat4x3 const &mat, glm::u8vec4 const &color) {
+void LineRecorder::draw_box(glm::mat4x3 const &mat, glm::u8vec4 const &color) {
 	//draw cube as three edge sets:
 
 	draw(mat * glm::vec4(-1.0f,-1.0f,-1.0f, 1.0f), mat * glm::vec4( 1.0f,-1.0f,-1.0f, 1.0f), color);
@@ -90,23 +139,15 @@ void DrawLines::draw_box(glm::mat4x3 const &mat, glm::u8vec4 const &color) {
 	draw(mat * glm::vec4( 1.0f, 1.0f,-1.0f, 1.0f), mat * glm::vec4( 1.0f, 1.0f, 1.0f, 1.0f), color);
 }
 
-void DrawLines::draw_text(std::string const &text, glm::vec3 const &anchor_in, glm::vec3 const &x, glm::vec3 const &y, glm::u8vec4 const &color, glm::vec3 *anchor_out) {
+void LineRecorder::draw_text(std::string const &text, glm::vec3 const &anchor_in, glm::vec3 const &x, glm::vec3 const &y, glm::u8vec4 const &color, glm::vec3 *anchor_out) {
 
 	glm::vec3 anchor = anchor_in;
 
 	uint32_t start = 0;
 	while (start < text.size()) {
-		uint32_t end = start;
-		uint32_t glyph = -1U;
-		while (end < text.size()) {
-			end += 1;
-			auto f = PathFont::font.glyph_map.find(text.substr(start, end-start));
-			if (f == PathFont::font.glyph_map.end()) {
-				end -= 1;
-				break;
-			}
-			glyph = f->second;
-		}
+		uint32_t length = 0;
+		uint32_t glyph = PathFont::font.lookup(text.data() + start, text.data() + text.size(), &length);
+		uint32_t end = start + length;
 		if (glyph == -1U) {
 			assert(start == end);
 			end += 1;
@@ -133,32 +174,73 @@ void DrawLines::draw_text(std::string const &text, glm::vec3 const &anchor_in, g
 }
 
 DrawLines::~DrawLines() {
-	if (attribs.empty()) return;
+	if (!attribs.empty()) flush();
 
+	//hand storage back to the arena:
+	attribs.clear();
+	spare_attribs().emplace_back(std::move(attribs));
+}
+
+void DrawLines::flush() {
 	//based on DrawSprites.cpp :
 
 	//upload vertices to vertex_buffer:
 	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer); //set vertex_buffer as current
-	glBufferData(GL_ARRAY_BUFFER, attribs.size() * sizeof(attribs[0]), attribs.data(), GL_STREAM_DRAW); //upload attribs array
+	GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+	if (attribs.size() > vertex_buffer_capacity) {
+		//grow (geometrically, so this stops happening quickly):
+		vertex_buffer_capacity = std::max(attribs.size(), std::max< size_t >(2 * vertex_buffer_capacity, 4096));
+		glBufferData(GL_ARRAY_BUFFER, vertex_buffer_capacity * sizeof(Vertex), nullptr, GL_STREAM_DRAW);
+		vertex_buffer_head = 0;
+	} else if (vertex_buffer_head + attribs.size() > vertex_buffer_capacity) {
+		//wrapped: orphan the old storage (the driver keeps it until pending draws are done):
+		access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+		vertex_buffer_head = 0;
+	}
+	//everything after vertex_buffer_head is unused since the last orphaning, so it is written without syncing:
+	GLintptr offset = vertex_buffer_head * sizeof(Vertex);
+	GLsizeiptr length = attribs.size() * sizeof(Vertex);
+	void *dst = glMapBufferRange(GL_ARRAY_BUFFER, offset, length, access);
+	if (dst) {
+		std::memcpy(dst, attribs.data(), length);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	} else {
+		glBufferSubData(GL_ARRAY_BUFFER, offset, length, attribs.data());
+	}
+	GLint first = GLint(vertex_buffer_head);
+	vertex_buffer_head += attribs.size();
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	//set color_program as current program:
-	glUseProgram(color_program->program);
+	draw_lines(vertex_buffer_for_color_program, world_to_clip, first, GLsizei(attribs.size()));
+}
 
-	//upload OBJECT_TO_CLIP to the proper uniform location:
-	glUniformMatrix4fv(color_program->OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(world_to_clip));
+LineBatch::LineBatch() {
+	glGenBuffers(1, &buffer);
+	vertex_array = make_vertex_array(buffer);
+}
 
-	//use the mapping vertex_buffer_for_color_program to fetch vertex data:
-	glBindVertexArray(vertex_buffer_for_color_program);
+LineBatch::~LineBatch() {
+	glDeleteVertexArrays(1, &vertex_array);
+	glDeleteBuffers(1, &buffer);
+}
 
-	//run the OpenGL pipeline:
-	glDrawArrays(GL_LINES, 0, GLsizei(attribs.size()));
+void LineBatch::clear() {
+	attribs.clear();
+	dirty = true;
+}
 
-	//reset vertex array to none:
-	glBindVertexArray(0);
+void LineBatch::draw(glm::mat4 const &world_to_clip) {
+	//recording only appends, so a changed count means new lines:
+	if (dirty || size_t(uploaded) != attribs.size()) {
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glBufferData(GL_ARRAY_BUFFER, attribs.size() * sizeof(Vertex), attribs.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		uploaded = GLsizei(attribs.size());
+		dirty = false;
+	}
+	if (uploaded == 0) return;
 
-	//reset current program to none:
-	glUseProgram(0);
+	draw_lines(vertex_array, world_to_clip, 0, uploaded);
 }
 
 
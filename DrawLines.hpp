@@ -9,15 +9,15 @@
  */
 
 
+#include "GL.hpp"
+
 #include <glm/glm.hpp>
 
 #include <string>
 #include <vector>
 
-struct DrawLines {
-	//Start drawing; will remember world_to_clip matrix:
-	DrawLines(glm::mat4 const &world_to_clip);
-
+//Line recording shared by immediate (DrawLines) and retained (LineBatch) drawing:
+struct LineRecorder {
 	//draw a single line from a to b (in world space):
 	void draw(glm::vec3 const &a, glm::vec3 const &b, glm::u8vec4 const &color = glm::u8vec4(0xff));
 
@@ -33,16 +33,47 @@ struct DrawLines {
 		glm::u8vec4 const &color = glm::u8vec4(0xff),
 		glm::vec3 *anchor_out = nullptr);
 
-	//Finish drawing (push attribs to GPU):
-	~DrawLines();
-
-
-	glm::mat4 world_to_clip;
 	struct Vertex {
 		Vertex(glm::vec3 const &Position_, glm::u8vec4 const &Color_) : Position(Position_), Color(Color_) { }
 		glm::vec3 Position;
 		glm::u8vec4 Color;
 	};
 	std::vector< Vertex > attribs;
+};
+
+struct DrawLines : LineRecorder {
+	//Start drawing; will remember world_to_clip matrix:
+	DrawLines(glm::mat4 const &world_to_clip);
+
+	//Finish drawing (push attribs to GPU):
+	~DrawLines();
+
+	glm::mat4 world_to_clip;
+	//(attribs storage is recycled between DrawLines instances)
+
+private:
+	//upload attribs to the shared streaming buffer and draw them:
+	void flush();
+};
+
+//Retained lines for content that rarely changes (e.g. level wireframes):
+// record with the LineRecorder functions, then draw() each frame -- the lines are uploaded to
+// their own buffer on the first draw and cost one draw call after that.
+// Call clear() and record again when the content changes.
+struct LineBatch : LineRecorder {
+	LineBatch();
+	LineBatch(LineBatch const &) = delete;
+	~LineBatch();
+
+	//draw the recorded lines, uploading them first if they changed:
+	void draw(glm::mat4 const &world_to_clip);
+	using LineRecorder::draw;
+
+	//forget the recorded lines:
+	void clear();
 
+	GLuint buffer = 0;
+	GLuint vertex_array = 0;
+	GLsizei uploaded = 0; //vertices in buffer
+	bool dirty = false; //buffer is stale even if the count matches
 };
@@ -1,6 +1,10 @@
 #include "DrawText.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <utility>
 #include <hb.h>
 #include <hb-ft.h>
 #include <glm/gtc/matrix_transform.hpp>
@@ -9,7 +13,7 @@
 #include "gl_errors.hpp"
 
 
-DrawText::DrawText(const char *font_path) {
+DrawText::DrawText(const char *font_path, Mode mode_) : mode(mode_) {
     /**
      * Freetype initialization codes come from its tutorial
      * https://www.freetype.org/freetype2/docs/tutorial/step1.html
@@ -25,17 +29,26 @@ DrawText::DrawText(const char *font_path) {
     } else if (error) {
         std::cerr << "Font file is broken." << std::endl;
     }
+    // shaping state is created once and kept in step with the face
+    hb_font = hb_ft_font_create(face_ft, nullptr);
+    hb_buffer = hb_buffer_create();
+    if (mode == SDF) {
+        // fields are always rendered at the reference size, set_font_size only scales them
+        FT_Set_Pixel_Sizes(face_ft, SDF_SIZE, 0);
+        hb_ft_font_changed(hb_font);
+    }
 
-    // OpenGL create related vertex data buffer. Every char is a rectangle
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, 6 * 4 * sizeof(GLfloat), nullptr, GL_DYNAMIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);  // unbind
-    glBindVertexArray(0);
+    // glyph atlas, cleared so the padding around glyphs stays empty
+    std::vector<GLubyte> blank(ATLAS_SIZE * ATLAS_SIZE, 0);
+    glGenTextures(1, &atlas);
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // disable alignment
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, ATLAS_SIZE, ATLAS_SIZE, 0, GL_RED, GL_UNSIGNED_BYTE, blank.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
 
     // shader adapted from https://learnopengl.com/In-Practice/Text-Rendering
     program = gl_compile_program(
@@ -44,9 +57,11 @@ DrawText::DrawText(const char *font_path) {
         "out vec2 TexCoords;\n"
         "\n"
         "uniform mat4 projection;\n"
+        "uniform vec2 offset;\n"  // start of the string, vertices are relative to it
+        "uniform float scale;\n"  // font size / rasterized size
         "\n"
         "void main() {\n"
-        "  gl_Position = projection * vec4(vertex.xy, 0.0, 1.0);\n"
+        "  gl_Position = projection * vec4(vertex.xy * scale + offset, 0.0, 1.0);\n"
         "  TexCoords = vertex.zw;\n"
         "}\n"
         ,
@@ -56,25 +71,48 @@ DrawText::DrawText(const char *font_path) {
         "\n"
         "uniform sampler2D text;\n"
         "uniform vec3 textColor;\n"
+        "uniform bool sdf;\n"
         "\n"
         "void main() {\n"
-        "  vec4 sampled = vec4(1.0, 1.0, 1.0, texture(text, TexCoords).r);\n"
+        "  float value = texture(text, TexCoords).r;\n"
+        "  if (sdf) {\n"
+        "    float width = fwidth(value);\n"  // about one screen pixel of the field, at any scale
+        "    value = smoothstep(0.5 - width, 0.5 + width, value);\n"
+        "  }\n"
+        "  vec4 sampled = vec4(1.0, 1.0, 1.0, value);\n"
         "  color = vec4(textColor, 1.0) * sampled;\n"
         "}\n"
     );
     text_color_loc = glGetUniformLocation(program, "textColor");
     projection_loc = glGetUniformLocation(program, "projection");
+    offset_loc = glGetUniformLocation(program, "offset");
+    scale_loc = glGetUniformLocation(program, "scale");
+    sdf_loc = glGetUniformLocation(program, "sdf");
+
+    rasterizer = std::thread(&DrawText::rasterize_glyphs, this, std::string(font_path));
 }
 
 DrawText::~DrawText() {
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        quit = true;
+    }
+    jobs_cv.notify_one();
+    rasterizer.join();
+
     delete_cache();
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    delete_runs();
+    glDeleteTextures(1, &atlas);
+    hb_buffer_destroy(hb_buffer);
+    hb_font_destroy(hb_font);
     FT_Done_Face(face_ft);
     FT_Done_FreeType(library);
 }
 
 void DrawText::set_font_size(int pixels) const {
+    font_size = pixels;
+    if (mode == SDF) return;
+
     // clear outdated cache
     delete_cache();
     
@@ -82,6 +120,7 @@ void DrawText::set_font_size(int pixels) const {
     if (error) {
         std::cerr << "Font size setting failed." << std::endl;
     }
+    hb_ft_font_changed(hb_font);
 }
 
 void DrawText::set_font_color(float r, float g, float b) const {
@@ -96,64 +135,282 @@ void DrawText::set_window_size(float w, float h) const {
 
 void DrawText::delete_cache() const {
     texture_cache.clear();
+    shelves.clear();
+    pending.clear();
+    ready.clear();
+    {
+        // glyphs already being rendered come back at the old size and are dropped on upload
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        requests.clear();
+    }
+    ++atlas_generation;
 }
 
-GLuint DrawText::add_texture(FT_ULong codepoint) const {
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // disable alignment
-    if (FT_Load_Glyph(face_ft, codepoint, FT_LOAD_RENDER) != 0) {
-        std::cerr << "Freetype char render error" << std::endl;
-        return 0U;
-    }
-    FT_Bitmap &bitmap = face_ft->glyph->bitmap;
-    GLuint texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexImage2D(
-        GL_TEXTURE_2D,
-        0,
-        GL_RED,  // grayscale
-        bitmap.width,
-        bitmap.rows,
-        0,
-        GL_RED,
-        GL_UNSIGNED_BYTE,
-        bitmap.buffer
-    );
+void DrawText::delete_run(Run &run) const {
+    if (run.vao) glDeleteVertexArrays(1, &run.vao);
+    if (run.vbo) glDeleteBuffers(1, &run.vbo);
+    run.vao = run.vbo = 0;
+}
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+void DrawText::delete_runs() const {
+    for (auto &entry : run_cache) {
+        delete_run(entry.second);
+    }
+    run_cache.clear();
+    run_lru.clear();
+}
 
-    // store cache
-    texture_cache.emplace(
-        std::piecewise_construct, 
-        std::make_tuple(codepoint), 
-        std::make_tuple(
-            texture, 
-            bitmap.width, 
-            bitmap.rows,
-            face_ft->glyph->bitmap_left,
-            face_ft->glyph->bitmap_top
-            )
-        );
-
-    // unbind texture
+// Signed distance field of a coverage bitmap, padded by SDF_SPREAD on every side. Edges sit at 0.5,
+// inside is brighter. Distances come from a two pass 8SSEDT sweep over pixel centers.
+static std::vector<GLubyte> distance_field(FT_Bitmap const &bitmap) {
+    const int spread = DrawText::SDF_SPREAD;
+    const int w = static_cast<int>(bitmap.width) + 2 * spread;
+    const int h = static_cast<int>(bitmap.rows) + 2 * spread;
+    std::vector<bool> inside(w * h, false);
+    for (int row = 0; row < static_cast<int>(bitmap.rows); ++row) {
+        for (int col = 0; col < static_cast<int>(bitmap.width); ++col) {
+            inside[(row + spread) * w + col + spread] = bitmap.buffer[row * bitmap.pitch + col] >= 128;
+        }
+    }
+
+    // distance from every pixel to the nearest pixel where `inside` equals `target`
+    auto distances = [&](bool target) {
+        const glm::ivec2 far(1 << 12);
+        std::vector<glm::ivec2> nearest(w * h);
+        for (int i = 0; i < w * h; ++i) {
+            nearest[i] = inside[i] == target ? glm::ivec2(0) : far;
+        }
+        auto length2 = [](glm::ivec2 v) { return v.x * v.x + v.y * v.y; };
+        auto compare = [&](int x, int y, int dx, int dy) {
+            if (x + dx < 0 || x + dx >= w || y + dy < 0 || y + dy >= h) return;
+            glm::ivec2 offset = nearest[(y + dy) * w + x + dx] + glm::ivec2(dx, dy);
+            if (length2(offset) < length2(nearest[y * w + x])) nearest[y * w + x] = offset;
+        };
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                compare(x, y, -1, 0);
+                compare(x, y, 0, -1);
+                compare(x, y, -1, -1);
+                compare(x, y, 1, -1);
+            }
+            for (int x = w - 1; x >= 0; --x) compare(x, y, 1, 0);
+        }
+        for (int y = h - 1; y >= 0; --y) {
+            for (int x = w - 1; x >= 0; --x) {
+                compare(x, y, 1, 0);
+                compare(x, y, 0, 1);
+                compare(x, y, -1, 1);
+                compare(x, y, 1, 1);
+            }
+            for (int x = 0; x < w; ++x) compare(x, y, -1, 0);
+        }
+        std::vector<float> result(w * h);
+        for (int i = 0; i < w * h; ++i) {
+            result[i] = std::sqrt(static_cast<float>(length2(nearest[i])));
+        }
+        return result;
+    };
+    std::vector<float> to_inside = distances(true);
+    std::vector<float> to_outside = distances(false);
+
+    std::vector<GLubyte> field(w * h);
+    for (int i = 0; i < w * h; ++i) {
+        // the edge lies half a pixel from the centers on either side of it
+        float signed_distance = inside[i] ? to_outside[i] - 0.5f : 0.5f - to_inside[i];
+        float value = 0.5f + 0.5f * signed_distance / spread;
+        field[i] = static_cast<GLubyte>(std::round(255.f * glm::clamp(value, 0.f, 1.f)));
+    }
+    return field;
+}
+
+void DrawText::rasterize_glyphs(std::string font_path) {
+    // FreeType faces can't be shared across threads, so this one is private to the rasterizer
+    FT_Library worker_library;
+    FT_Face face;
+    if (FT_Init_FreeType(&worker_library) != 0 || FT_New_Face(worker_library, font_path.c_str(), 0, &face) != 0) {
+        std::cerr << "Freetype rasterizer initialization failed." << std::endl;
+        return;
+    }
+    int face_size = 0;
+
+    std::unique_lock<std::mutex> lock(jobs_mutex);
+    while (true) {
+        jobs_cv.wait(lock, [this]() { return quit || !requests.empty(); });
+        if (quit) break;
+        GlyphImage image = std::move(requests.front());
+        requests.pop_front();
+        lock.unlock();
+
+        if (image.size != face_size && image.size > 0) {
+            FT_Set_Pixel_Sizes(face, image.size, 0);
+            face_size = image.size;
+        }
+        if (FT_Load_Glyph(face, image.codepoint, FT_LOAD_RENDER) != 0) {
+            // handed back blank, so it is not retried every frame
+            std::cerr << "Freetype char render error" << std::endl;
+        } else if (face->glyph->bitmap.width != 0 && face->glyph->bitmap.rows != 0) {
+            FT_Bitmap const &bitmap = face->glyph->bitmap;
+            image.w = bitmap.width;
+            image.h = bitmap.rows;
+            image.left = face->glyph->bitmap_left;
+            image.top = face->glyph->bitmap_top;
+            if (mode == SDF) {
+                // the field grows the glyph by the spread on every side
+                image.pixels = distance_field(bitmap);
+                image.w += 2 * SDF_SPREAD;
+                image.h += 2 * SDF_SPREAD;
+                image.left -= SDF_SPREAD;
+                image.top += SDF_SPREAD;
+            } else {
+                image.pixels.resize(image.w * image.h);
+                for (unsigned int row = 0; row < image.h; ++row) {
+                    std::memcpy(&image.pixels[row * image.w], bitmap.buffer + static_cast<int>(row) * bitmap.pitch, image.w);
+                }
+            }
+        }
+
+        lock.lock();
+        finished.emplace_back(std::move(image));
+    }
+    lock.unlock();
+
+    FT_Done_Face(face);
+    FT_Done_FreeType(worker_library);
+}
+
+void DrawText::request_glyph(FT_ULong codepoint) const {
+    if (!pending.insert(codepoint).second) return;
+    GlyphImage request;
+    request.codepoint = codepoint;
+    request.size = raster_size();
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        requests.emplace_back(std::move(request));
+    }
+    jobs_cv.notify_one();
+}
+
+void DrawText::upload_glyphs() const {
+    {
+        // only moves vectors around, so the rasterizer never holds the render thread up for long
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        for (GlyphImage &image : finished) {
+            ready.emplace_back(std::move(image));
+        }
+        finished.clear();
+    }
+    if (ready.empty()) return;
+
+    // shelves drawn since the previous upload are likely still on screen, so they are kept
+    uint64_t evictable_until = last_upload_clock;
+    last_upload_clock = ++use_clock;
+
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // disable alignment
+    std::vector<GlyphImage> waiting;
+    for (GlyphImage &image : ready) {
+        // rendered for a font size that has been left since, or a duplicate
+        if (image.size != raster_size() || texture_cache.count(image.codepoint)) continue;
+        if (add_texture(image, evictable_until)) {
+            pending.erase(image.codepoint);
+        } else {
+            waiting.emplace_back(std::move(image));
+        }
+    }
+    ready = std::move(waiting);
     glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+size_t DrawText::place(unsigned int w, unsigned int h, uint64_t evictable_until) const {
+    if (w > ATLAS_SIZE || h > ATLAS_SIZE) return Bitmap::NO_SHELF;
 
-    return texture;
+    // the lowest shelf with room wastes the least height
+    size_t best = Bitmap::NO_SHELF;
+    for (size_t i = 0; i < shelves.size(); ++i) {
+        Shelf const &shelf = shelves[i];
+        if (shelf.height >= h && shelf.x + w <= ATLAS_SIZE
+            && (best == Bitmap::NO_SHELF || shelf.height < shelves[best].height)) {
+            best = i;
+        }
+    }
+    if (best != Bitmap::NO_SHELF) return best;
+
+    // open a new shelf below the others
+    unsigned int bottom = shelves.empty() ? 0U : shelves.back().y + shelves.back().height;
+    if (bottom + h <= ATLAS_SIZE) {
+        Shelf shelf;
+        shelf.y = bottom;
+        shelf.height = h;
+        shelves.emplace_back(shelf);
+        return shelves.size() - 1;
+    }
+
+    // atlas is full: empty the least recently used shelf that is tall enough
+    for (size_t i = 0; i < shelves.size(); ++i) {
+        Shelf const &shelf = shelves[i];
+        if (shelf.height >= h && shelf.last_use <= evictable_until
+            && (best == Bitmap::NO_SHELF || shelf.last_use < shelves[best].last_use)) {
+            best = i;
+        }
+    }
+    if (best == Bitmap::NO_SHELF) return best;
+    ++atlas_generation;
+    Shelf &shelf = shelves[best];
+    for (FT_ULong glyph : shelf.glyphs) {
+        texture_cache.erase(glyph);
+    }
+    shelf.glyphs.clear();
+    shelf.x = 0;
+    return best;
 }
 
-void DrawText::draw(const char *text, float x, float y) const {
-    // The draw codes are adapted from the following references
-    // https://github.com/harfbuzz/harfbuzz-tutorial/blob/master/hello-harfbuzz-freetype.c
-    // https://learnopengl-cn.github.io/06%20In%20Practice/02%20Text%20Rendering/
-    hb_font_t *hb_font;
-    hb_font = hb_ft_font_create(face_ft, nullptr);
+bool DrawText::add_texture(GlyphImage const &image, uint64_t evictable_until) const {
+    Bitmap glyph{0U, 0U, image.w, image.h, image.left, image.top, Bitmap::NO_SHELF};
 
-    // create hb buffer
-    hb_buffer_t *hb_buffer;
-    hb_buffer = hb_buffer_create();
+    if (!image.pixels.empty()) {
+        // the cell keeps a blank border around the glyph, so linear filtering doesn't pick up neighbours
+        unsigned int cell_w = glyph.w + 2, cell_h = glyph.h + 2;
+        glyph.shelf = place(cell_w, cell_h, evictable_until);
+        if (glyph.shelf == Bitmap::NO_SHELF) {
+            return false;
+        }
+        Shelf &shelf = shelves[glyph.shelf];
+
+        std::vector<GLubyte> cell(cell_w * cell_h, 0);
+        for (unsigned int row = 0; row < glyph.h; ++row) {
+            std::memcpy(&cell[(row + 1) * cell_w + 1], &image.pixels[row * glyph.w], glyph.w);
+        }
+        // the atlas is bound by upload_glyphs
+        glTexSubImage2D(GL_TEXTURE_2D, 0, shelf.x, shelf.y, cell_w, cell_h, GL_RED, GL_UNSIGNED_BYTE, cell.data());
+
+        glyph.x = shelf.x + 1;
+        glyph.y = shelf.y + 1;
+        shelf.x += cell_w;
+        shelf.glyphs.emplace_back(image.codepoint);
+    }
+
+    // store cache
+    texture_cache.emplace(image.codepoint, glyph);
+    return true;
+}
+
+DrawText::Run &DrawText::shape(const char *text) const {
+    std::string key = std::to_string(raster_size()) + '\n' + text;
+    auto it = run_cache.find(key);
+    if (it != run_cache.end()) {
+        run_lru.splice(run_lru.begin(), run_lru, it->second.lru);
+        return it->second;
+    }
+    if (run_cache.size() >= RUN_CACHE_SIZE) {
+        auto oldest = run_cache.find(run_lru.back());
+        delete_run(oldest->second);
+        run_cache.erase(oldest);
+        run_lru.pop_back();
+    }
+
+    // The shaping codes are adapted from
+    // https://github.com/harfbuzz/harfbuzz-tutorial/blob/master/hello-harfbuzz-freetype.c
+    hb_buffer_reset(hb_buffer);
     hb_buffer_add_utf8(hb_buffer, text, -1, 0, -1);
     hb_buffer_guess_segment_properties(hb_buffer);
 
@@ -165,64 +422,114 @@ void DrawText::draw(const char *text, float x, float y) const {
     hb_glyph_info_t *info = hb_buffer_get_glyph_infos(hb_buffer, nullptr);
     hb_glyph_position_t *pos = hb_buffer_get_glyph_positions(hb_buffer, nullptr);
 
-    // render
-    glUseProgram(program);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glUniform3f(text_color_loc, text_color.r, text_color.g, text_color.b);
-    glUniformMatrix4fv(projection_loc, 1, GL_FALSE, &projection[0].x);
-    glActiveTexture(GL_TEXTURE0);
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
+    run_lru.emplace_front(key);
+    Run &run = run_cache[key];
+    run.lru = run_lru.begin();
+    run.glyphs.reserve(len);
+    glm::vec2 pen(0.f);
     for (size_t i = 0; i < len; ++i) {
-        FT_ULong glyph_id = info[i].codepoint;
-        float x_advance = pos[i].x_advance / 64.f;
-        float y_advance = pos[i].y_advance / 64.f;
-        float x_offset  = pos[i].x_offset / 64.f;
-        float y_offset  = pos[i].y_offset / 64.f;
-
+        glm::vec2 offset(pos[i].x_offset / 64.f, pos[i].y_offset / 64.f);
+        run.glyphs.emplace_back(ShapedGlyph{info[i].codepoint, pen + offset});
+        pen += glm::vec2(pos[i].x_advance / 64.f, pos[i].y_advance / 64.f);
+    }
+    return run;
+}
 
+void DrawText::build_vertices(Run &run) const {
+    bool complete = true;
+    vertices.clear();
+    run.shelves.clear();
+    const float texel = 1.f / ATLAS_SIZE;
+    for (ShapedGlyph const &glyph : run.glyphs) {
         // look up texture
-        auto it = texture_cache.find(glyph_id);
+        auto it = texture_cache.find(glyph.codepoint);
         if (it == texture_cache.end()) {
-            add_texture(glyph_id);
-            it = texture_cache.find(glyph_id);
+            // left blank until the rasterizer is done with it
+            request_glyph(glyph.codepoint);
+            complete = false;
+            continue;
         }
-        auto& bitmap = it->second;
+        Bitmap const *bitmap = &it->second;
+        if (bitmap->shelf == Bitmap::NO_SHELF) continue;
+
+        shelves[bitmap->shelf].last_use = use_clock;
+        run.shelves.emplace_back(bitmap->shelf);
+
+        GLfloat xpos = glyph.pen.x + bitmap->left, ypos = glyph.pen.y - bitmap->h + bitmap->top;
+        GLfloat w = static_cast<GLfloat>(bitmap->w), h = static_cast<GLfloat>(bitmap->h);
+        GLfloat u0 = bitmap->x * texel, v0 = bitmap->y * texel;
+        GLfloat u1 = (bitmap->x + bitmap->w) * texel, v1 = (bitmap->y + bitmap->h) * texel;
+
+        const glm::vec4 quad[6] = {
+            {xpos, ypos+h, u0, v0},
+            {xpos, ypos, u0, v1},
+            {xpos+w, ypos, u1, v1},
+            {xpos, ypos+h, u0, v0},
+            {xpos+w, ypos, u1, v1},
+            {xpos+w, ypos+h, u1, v0}
+        };
+        vertices.insert(vertices.end(), quad, quad + 6);
+    }
 
-        GLfloat xpos = x + x_offset + bitmap.left, ypos = y + y_offset - bitmap.h + bitmap.top;
+    std::sort(run.shelves.begin(), run.shelves.end());
+    run.shelves.erase(std::unique(run.shelves.begin(), run.shelves.end()), run.shelves.end());
+    if (!run.vao) {
+        glGenVertexArrays(1, &run.vao);
+        glGenBuffers(1, &run.vbo);
+        glBindVertexArray(run.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, run.vbo);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, run.vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec4), vertices.data(), GL_STATIC_DRAW);
+    run.count = static_cast<GLsizei>(vertices.size());
+    // a run with glyphs still missing is rebuilt on every draw until they arrive
+    run.generation = complete ? atlas_generation : 0;
+    vertices.clear();
 
-        GLfloat vertices[6][4] = {
-            {xpos, ypos+bitmap.h, 0.f, 0.f},
-            {xpos, ypos, 0.f, 1.f},
-            {xpos+bitmap.w, ypos, 1.f, 1.f},
-            {xpos, ypos+bitmap.h, 0.f, 0.f},
-            {xpos+bitmap.w, ypos, 1.f, 1.f},
-            {xpos+bitmap.w, ypos+bitmap.h, 1.f, 0.f}  
-        };
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+}
 
-        // bind texture
-        glBindTexture(GL_TEXTURE_2D, bitmap.texture_id);
+void DrawText::draw(const char *text, float x, float y) const {
+    // The draw codes are adapted from the following references
+    // https://github.com/harfbuzz/harfbuzz-tutorial/blob/master/hello-harfbuzz-freetype.c
+    // https://learnopengl-cn.github.io/06%20In%20Practice/02%20Text%20Rendering/
+    upload_glyphs();
+    Run &run = shape(text);
 
-        // update vertices data
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
+    // render
+    glUseProgram(program);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glUniform3f(text_color_loc, text_color.r, text_color.g, text_color.b);
+    glUniformMatrix4fv(projection_loc, 1, GL_FALSE, &projection[0].x);
+    glUniform2f(offset_loc, x, y);
+    glUniform1f(scale_loc, mode == SDF ? static_cast<float>(font_size) / SDF_SIZE : 1.f);
+    glUniform1i(sdf_loc, mode == SDF);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, atlas);
+
+    ++use_clock;
+    if (run.generation != atlas_generation) {
+        build_vertices(run);
+    } else {
+        // quads are still valid, only keep their shelves from being evicted
+        for (size_t shelf : run.shelves) {
+            shelves[shelf].last_use = use_clock;
+        }
+    }
+    if (run.count != 0) {
         // draw call
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-
-        x += x_advance;
-        y += y_advance;
+        glBindVertexArray(run.vao);
+        glDrawArrays(GL_TRIANGLES, 0, run.count);
     }
 
     GL_ERRORS();
 
     // unbind
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
     glBindTexture(GL_TEXTURE_2D, 0);
     glUseProgram(0);
-
-    // cleaning
-    hb_buffer_destroy(hb_buffer);
-    hb_font_destroy(hb_font);
-}
\ No newline at end of file
+}
@@ -14,34 +14,58 @@
  */
 
 
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <cstdint>
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include <glm/glm.hpp>
 
 #include "GL.hpp"
 
+struct hb_font_t;
+struct hb_buffer_t;
 
-// cache element
+// cache element: where a rendered glyph sits in the atlas
 struct Bitmap {
-    GLuint texture_id;
+    unsigned int x, y;  // upper left corner in the atlas
     unsigned int w, h;
     int left, top;
-    Bitmap(GLuint id, unsigned int w, unsigned int h, int l, int t): 
-        texture_id(id), w(w), h(h), left(l), top(t) {}
-    ~Bitmap() {
-        glDeleteTextures(1, &texture_id);
-    }
+    size_t shelf;  // shelf of the atlas holding it, NO_SHELF for blank glyphs
+    static constexpr size_t NO_SHELF = static_cast<size_t>(-1);
+};
+
+// glyph rendered by the rasterizer thread, waiting to be packed into the atlas
+struct GlyphImage {
+    FT_ULong codepoint;
+    int size;  // pixel size it was rendered at
+    unsigned int w = 0, h = 0;
+    int left = 0, top = 0;
+    std::vector<GLubyte> pixels;  // w * h, rows top to bottom
 };
 
 class DrawText {
 public:
+    // BITMAP rasterizes glyphs at the font size. SDF rasterizes them once as signed distance fields at
+    // SDF_SIZE pixels and scales those, so the font size can change freely without re-rendering.
+    enum Mode {
+        BITMAP = 0,
+        SDF
+    };
+
     DrawText()=delete;
-    DrawText(const char *font_file);
+    DrawText(const char *font_file, Mode mode = BITMAP);
     DrawText(const DrawText&)=delete;
     ~DrawText();
 
-    // This will clear texture cache!
+    // In BITMAP mode this will clear texture cache!
     void set_font_size(int pixels) const;
 
     void set_font_color(float r, float g, float b) const;
@@ -50,18 +74,98 @@ public:
     
     void draw(const char *text, float x, float y) const;
 
+    // Glyphs are rendered by a background thread. Call this once at the start of a frame to pack the
+    // finished ones into the atlas in one go; draw calls it as well, so it is cheap when idle.
+    // Until then a glyph is left blank, keeping its advance.
+    void upload_glyphs() const;
+
+    // Glyphs are packed into one ATLAS_SIZE^2 single channel texture, in shelves (rows of glyphs
+    // sharing a height). When it is full, the least recently drawn shelf is emptied for reuse.
+    static constexpr unsigned int ATLAS_SIZE = 1024;
+
+    // Shaped strings are kept for reuse, keyed on text and font size, with their vertices in their
+    // own buffer; the least recently drawn is dropped past RUN_CACHE_SIZE.
+    static constexpr size_t RUN_CACHE_SIZE = 64;
+
+    static constexpr int SDF_SIZE = 48;  // pixel size distance fields are rendered at
+    static constexpr int SDF_SPREAD = 6;  // pixels of distance a field covers on either side of an edge
+
 private:
-    GLuint add_texture(FT_ULong codepoint) const;
+    struct ShapedGlyph {
+        FT_ULong codepoint;  // glyph index in the face
+        glm::vec2 pen;  // origin relative to the start of the string
+    };
+
+    struct Run {
+        std::vector<ShapedGlyph> glyphs;
+        GLuint vao = 0, vbo = 0;  // quads relative to the start of the string
+        GLsizei count = 0;  // vertices in vbo
+        uint64_t generation = 0;  // atlas generation the quads were built for
+        std::vector<size_t> shelves;  // atlas shelves the quads sample
+        std::list<std::string>::iterator lru;
+    };
+
+    // shaped run of text at the current font size, from cache or HarfBuzz
+    Run &shape(const char *text) const;
+
+    // (re)build the quads of a run, requesting glyphs the atlas doesn't have yet
+    void build_vertices(Run &run) const;
+
+    void delete_run(Run &run) const;
+
+    struct Shelf {
+        unsigned int y, height;
+        unsigned int x = 0;  // start of the free space
+        uint64_t last_use = 0;  // draw call it was last sampled by
+        std::vector<FT_ULong> glyphs;
+    };
+
+    // queue a glyph for the rasterizer thread, once
+    void request_glyph(FT_ULong codepoint) const;
+
+    // copy a rendered glyph into the atlas, false when there is no room left for it
+    bool add_texture(GlyphImage const &image, uint64_t evictable_until) const;
+
+    // find room for a w x h cell, evicting a shelf last drawn at or before `evictable_until` if needed;
+    // returns the shelf index or NO_SHELF
+    size_t place(unsigned int w, unsigned int h, uint64_t evictable_until) const;
+
+    // body of the rasterizer thread, which owns its own FreeType face
+    void rasterize_glyphs(std::string font_path);
+
+    // font size glyphs are shaped and rasterized at
+    int raster_size() const { return mode == SDF ? SDF_SIZE : font_size; }
 
     void delete_cache() const;
+    void delete_runs() const;
 
     FT_Library library;  // handle to library
     FT_Face face_ft;  // face object handle
-    GLuint VAO;  // character vertex buffer
-    GLuint VBO;
+    hb_font_t *hb_font;  // follows the face size
+    hb_buffer_t *hb_buffer;  // reused for shaping
+    mutable int font_size = 0;
+    const Mode mode;
+    GLuint atlas;  // GL_R8 glyph atlas
     GLuint program;
     mutable glm::vec3 text_color;
     mutable glm::mat4 projection;
-    GLuint projection_loc, text_color_loc;
+    GLuint projection_loc, text_color_loc, offset_loc, scale_loc, sdf_loc;
     mutable std::unordered_map<FT_ULong, Bitmap> texture_cache;
+    mutable std::vector<Shelf> shelves;
+    mutable uint64_t use_clock = 0;  // counts draw batches, for shelf eviction
+    mutable uint64_t last_upload_clock = 0;  // use_clock at the last glyph upload
+    mutable uint64_t atlas_generation = 1;  // bumped whenever glyphs leave the atlas
+    mutable std::unordered_map<std::string, Run> run_cache;  // key: font size, '\n', text
+    mutable std::list<std::string> run_lru;  // most recently drawn first
+    mutable std::vector<glm::vec4> vertices;  // [posx, posy, texx, texy] of the run being built
+    mutable std::unordered_set<FT_ULong> pending;  // requested, not in the atlas yet
+    mutable std::vector<GlyphImage> ready;  // rendered, waiting for room in the atlas
+
+    // shared with the rasterizer thread, guarded by jobs_mutex
+    mutable std::mutex jobs_mutex;
+    mutable std::condition_variable jobs_cv;
+    mutable std::deque<GlyphImage> requests;  // only codepoint and size are set
+    mutable std::vector<GlyphImage> finished;
+    bool quit = false;
+    std::thread rasterizer;
 };
\ No newline at end of file
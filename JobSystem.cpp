@@ -0,0 +1,115 @@
+#include "JobSystem.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <system_error>
+
+JobSystem::JobSystem(uint32_t workers) : queues(workers + 1) {
+	threads.reserve(workers);
+	try {
+		for (uint32_t i = 0; i < workers; ++i) {
+			threads.emplace_back(&JobSystem::worker, this, size_t(i));
+		}
+	} catch (std::system_error const &e) {
+		//(e.g., built without -pthread) carry on with the workers that did start; parallel_for still runs on the caller:
+		std::cerr << "WARNING: JobSystem started " << threads.size() << " of " << workers << " worker threads: " << e.what() << std::endl;
+	}
+	//(queues of workers that didn't start still get chunks dealt to them; those are stolen like any others)
+}
+
+JobSystem::~JobSystem() {
+	{
+		std::unique_lock< std::mutex > lock(sleep_mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for (auto &thread : threads) {
+		thread.join();
+	}
+}
+
+JobSystem &JobSystem::get() {
+	static JobSystem job_system(std::max(1U, std::thread::hardware_concurrency()) - 1);
+	return job_system;
+}
+
+void JobSystem::parallel_for(size_t count, size_t grain, std::function< void(size_t, size_t) > const &body) {
+	if (count == 0) return;
+	grain = std::max< size_t >(grain, 1);
+
+	//small (or single-threaded) cases don't need the queues at all:
+	if (count <= grain || threads.empty()) {
+		body(0, count);
+		return;
+	}
+
+	size_t chunks = (count + grain - 1) / grain;
+	std::atomic< size_t > remaining(chunks);
+
+	//counted before they are queued, so 'queued' never dips below the jobs actually in queues:
+	{
+		std::unique_lock< std::mutex > lock(sleep_mutex);
+		queued += chunks;
+	}
+
+	//deal chunks round-robin so every worker starts with some of its own:
+	for (size_t c = 0; c < chunks; ++c) {
+		Job job;
+		job.body = &body;
+		job.begin = c * grain;
+		job.end = std::min(count, job.begin + grain);
+		job.remaining = &remaining;
+
+		Queue &queue = queues[c % queues.size()];
+		std::unique_lock< std::mutex > lock(queue.mutex);
+		queue.jobs.emplace_back(job);
+	}
+	wake.notify_all();
+
+	//help out until every chunk has finished (some may still be running on workers):
+	size_t home = queues.size() - 1;
+	while (remaining.load() != 0) {
+		if (!try_run_one(home)) std::this_thread::yield();
+	}
+}
+
+bool JobSystem::try_run_one(size_t home) {
+	Job job;
+	bool found = false;
+
+	{ //own queue first, newest job (most likely still in cache):
+		Queue &queue = queues[home];
+		std::unique_lock< std::mutex > lock(queue.mutex);
+		if (!queue.jobs.empty()) {
+			job = queue.jobs.back();
+			queue.jobs.pop_back();
+			found = true;
+		}
+	}
+	//..then steal the oldest job from someone else:
+	for (size_t offset = 1; !found && offset < queues.size(); ++offset) {
+		Queue &queue = queues[(home + offset) % queues.size()];
+		std::unique_lock< std::mutex > lock(queue.mutex);
+		if (!queue.jobs.empty()) {
+			job = queue.jobs.front();
+			queue.jobs.pop_front();
+			found = true;
+		}
+	}
+	if (!found) return false;
+
+	queued -= 1;
+	(*job.body)(job.begin, job.end);
+	job.remaining->fetch_sub(1);
+	return true;
+}
+
+void JobSystem::worker(size_t home) {
+	while (true) {
+		if (try_run_one(home)) continue;
+
+		std::unique_lock< std::mutex > lock(sleep_mutex);
+		wake.wait(lock, [this](){ return quit || queued.load() != 0; });
+		if (quit) return;
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+/*
+ * A small work-stealing job system for data-parallel loops.
+ *
+ * parallel_for() splits a range into chunks and spreads them over per-thread
+ *  queues; each thread pops from the back of its own queue and, when that is
+ *  empty, steals from the front of the others. The calling thread works too,
+ *  and the call returns once every chunk is done.
+ *
+ * //example:
+ * JobSystem::get().parallel_for(values.size(), 256, [&](size_t begin, size_t end) {
+ *     for (size_t i = begin; i < end; ++i) values[i] = f(values[i]);
+ * });
+ *
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct JobSystem {
+	//start 'workers' worker threads (plus whichever thread calls parallel_for):
+	explicit JobSystem(uint32_t workers);
+	~JobSystem();
+
+	//a job system with one worker per core beyond the first, started on first use:
+	static JobSystem &get();
+
+	//call body(begin, end) on chunks of at most 'grain' indices covering [0, count):
+	// (ranges of at most 'grain' indices run directly on the calling thread)
+	void parallel_for(size_t count, size_t grain, std::function< void(size_t, size_t) > const &body);
+
+	//-- internals ---
+
+	struct Job {
+		std::function< void(size_t, size_t) > const *body = nullptr;
+		size_t begin = 0, end = 0;
+		std::atomic< size_t > *remaining = nullptr; //chunks of this parallel_for not yet finished
+	};
+
+	//one queue per worker, plus one (the last) shared by threads calling parallel_for:
+	struct Queue {
+		std::mutex mutex;
+		std::deque< Job > jobs;
+	};
+	std::vector< Queue > queues;
+
+	std::vector< std::thread > threads;
+
+	//workers sleep here when there's nothing to steal:
+	std::mutex sleep_mutex;
+	std::condition_variable wake;
+	std::atomic< size_t > queued{0}; //jobs sitting in any queue
+	bool quit = false;
+
+	//pop own work or steal someone else's; false if every queue was empty:
+	bool try_run_one(size_t home);
+	void worker(size_t home);
+};
@@ -17,10 +17,10 @@ struct LitColorTextureProgram {
 	GLuint Color_vec4 = -1U;
 	GLuint TexCoord_vec2 = -1U;
 
+	//Uniform block indices:
+	GLuint OBJECT_block = -1U; //"Object" block, see Scene::ObjectBlock
+
 	//Uniform (per-invocation variable) locations:
-	GLuint OBJECT_TO_CLIP_mat4 = -1U;
-	GLuint OBJECT_TO_LIGHT_mat4x3 = -1U;
-	GLuint NORMAL_TO_LIGHT_mat3 = -1U;
 
 	//lighting:
 	GLuint LIGHT_TYPE_int = -1U;
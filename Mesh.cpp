@@ -10,6 +10,7 @@
 #include <string>
 #include <set>
 #include <cstddef>
+#include <cmath>
 
 MeshBuffer::MeshBuffer(std::string const &filename) {
 	glGenBuffers(1, &buffer);
@@ -68,6 +69,27 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 				throw std::runtime_error("index entry has out-of-range vertex start/count");
 			}
 			std::string name(&strings[0] + entry.name_begin, &strings[0] + entry.name_end);
+
+			//repeated names are coarser levels of detail of the first entry with that name,
+			// as long as each has fewer vertices than the level before it (anything else is a name collision):
+			// (every level halves the suggested screen size, starting from a quarter of the screen)
+			auto existing = meshes.find(name);
+			if (existing != meshes.end()) {
+				Mesh &mesh = existing->second;
+				GLuint previous = (mesh.lods.empty() ? mesh.count : mesh.lods.back().count);
+				GLuint count = entry.vertex_end - entry.vertex_begin;
+				if (count < previous) {
+					Mesh::LOD lod;
+					lod.start = entry.vertex_begin;
+					lod.count = count;
+					lod.screen_size = std::ldexp(0.25f, -int(mesh.lods.size()));
+					mesh.lods.emplace_back(lod);
+				} else {
+					std::cerr << "WARNING: mesh name '" + name + "' in filename '" + filename + "' collides with existing mesh." << std::endl;
+				}
+				continue;
+			}
+
 			Mesh mesh;
 			mesh.type = GL_TRIANGLES;
 			mesh.start = entry.vertex_begin;
@@ -76,10 +98,7 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 				mesh.min = glm::min(mesh.min, data[v].Position);
 				mesh.max = glm::max(mesh.max, data[v].Position);
 			}
-			bool inserted = meshes.insert(std::make_pair(name, mesh)).second;
-			if (!inserted) {
-				std::cerr << "WARNING: mesh name '" + name + "' in filename '" + filename + "' collides with existing mesh." << std::endl;
-			}
+			meshes.insert(std::make_pair(name, mesh));
 		}
 	}
 
@@ -7,6 +7,9 @@
  *  a single OpenGL array buffer. Individual meshes can be looked up by name
  *  using the MeshBuffer::lookup() function.
  *
+ * A mesh may come with coarser "levels of detail" (decimated copies written
+ *  by export-meshes.py) in Mesh::lods, to draw instead when it is far away.
+ *
  */
 
 #include "GL.hpp"
@@ -14,6 +17,7 @@
 #include <map>
 #include <limits>
 #include <string>
+#include <vector>
 
 
 struct Mesh {
@@ -27,6 +31,16 @@ struct Mesh {
 	//useful for debug visualization and (perhaps, eventually) collision detection:
 	glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
 	glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+
+	//Coarser versions of the mesh, finest first (not including the mesh itself).
+	//screen_size is a suggested switch point: use the level once the mesh's bounds cover less than
+	// this fraction of the viewport height (see Scene::Drawable::lods):
+	struct LOD {
+		GLuint start = 0;
+		GLuint count = 0;
+		float screen_size = 0.0f;
+	};
+	std::vector< LOD > lods;
 };
 
 struct MeshBuffer {
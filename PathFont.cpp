@@ -3,22 +3,44 @@
 
 #include "PathFont.hpp"
 
-#include <iostream>
-
 PathFont::PathFont(uint32_t glyphs_,
 	const float *glyph_widths_,
 	const uint32_t *glyph_char_starts_, const uint8_t *chars_,
-	const uint32_t *glyph_coord_starts_, const float *coords_
+	const uint32_t *glyph_coord_starts_, const float *coords_,
+	const uint32_t *trie_root_, const uint32_t *trie_node_glyphs_,
+	const uint32_t *trie_node_edge_starts_, const uint8_t *trie_edge_bytes_, const uint32_t *trie_edge_nodes_
 	) : glyphs(glyphs_),
 		glyph_widths(glyph_widths_),
 		glyph_char_starts(glyph_char_starts_), chars(chars_),
-		glyph_coord_starts(glyph_coord_starts_), coords(coords_) {
+		glyph_coord_starts(glyph_coord_starts_), coords(coords_),
+		trie_root(trie_root_), trie_node_glyphs(trie_node_glyphs_),
+		trie_node_edge_starts(trie_node_edge_starts_), trie_edge_bytes(trie_edge_bytes_), trie_edge_nodes(trie_edge_nodes_) {
+}
 
-	for (uint32_t i = 0; i < glyphs; ++i) {
-		std::string str(reinterpret_cast< const char * >(chars + glyph_char_starts[i]), reinterpret_cast< const char * >(chars + glyph_char_starts[i+1]));
-		auto res = glyph_map.insert(std::make_pair(str, i));
-		if (!res.second) {
-			std::cerr << "WARNING: ignoring duplicate glyph for '" << str << "'." << std::endl;
+uint32_t PathFont::lookup(const char *begin, const char *end, uint32_t *length) const {
+	uint32_t glyph = -1U;
+	*length = 0;
+	if (begin == end) return glyph;
+
+	uint32_t node = trie_root[static_cast< uint8_t >(*begin)];
+	uint32_t depth = 1;
+	while (node != -1U) {
+		if (trie_node_glyphs[node] != -1U) {
+			glyph = trie_node_glyphs[node];
+			*length = depth;
+		}
+		if (begin + depth == end) break;
+		//nodes have few children, so they are scanned:
+		uint8_t next = static_cast< uint8_t >(begin[depth]);
+		uint32_t child = -1U;
+		for (uint32_t e = trie_node_edge_starts[node]; e < trie_node_edge_starts[node+1]; ++e) {
+			if (trie_edge_bytes[e] == next) {
+				child = trie_edge_nodes[e];
+				break;
+			}
 		}
+		node = child;
+		depth += 1;
 	}
+	return glyph;
 }
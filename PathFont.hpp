@@ -10,16 +10,16 @@
 
 #include <glm/glm.hpp>
 
-#include <string>
-#include <vector>
-#include <map>
+#include <cstdint>
 
 struct PathFont {
 	//meant to be intitialized with some pointers to constant data:
 	PathFont(uint32_t glyphs,
 		const float *glyph_widths,
 		const uint32_t *glyph_char_starts, const uint8_t *chars,
-		const uint32_t *glyph_coord_starts, const float *coords
+		const uint32_t *glyph_coord_starts, const float *coords,
+		const uint32_t *trie_root, const uint32_t *trie_node_glyphs,
+		const uint32_t *trie_node_edge_starts, const uint8_t *trie_edge_bytes, const uint32_t *trie_edge_nodes
 		);
 	const uint32_t glyphs = 0;
 	const float *glyph_widths = nullptr;
@@ -30,8 +30,15 @@ struct PathFont {
 	const uint32_t *glyph_coord_starts = nullptr; //indices into 'coords' table
 	const float *coords = nullptr;
 
-	//computed in constructor:
-	std::map< std::string, uint32_t > glyph_map;
+	//glyph lookup trie over the utf8 bytes of glyph names, generated with the font:
+	const uint32_t *trie_root = nullptr; //first byte -> node (-1U if no name starts with it)
+	const uint32_t *trie_node_glyphs = nullptr; //node -> glyph whose name ends there, or -1U
+	const uint32_t *trie_node_edge_starts = nullptr; //indices into the 'trie_edge_*' tables
+	const uint8_t *trie_edge_bytes = nullptr; //next byte
+	const uint32_t *trie_edge_nodes = nullptr; //node reached with it
+
+	//longest glyph name at the start of [begin,end); returns the glyph (or -1U) and stores its length:
+	uint32_t lookup(const char *begin, const char *end, uint32_t *length) const;
 
 	//the default font:
 	static PathFont font;
@@ -35,7 +35,6 @@ PlayMode::PlayMode(Client &client_) : drawable_size({1280U, 720U}), client(clien
 		glm::vec2(),
 		glm::vec2()
 	}, TileDrawer::MAP);
-	tile_drawer.update_vertices(TileDrawer::MAP);
 	map_components.push_back(index);
 	collider.add_component(glm::vec2(drawable_size.x / 2, drawable_size.y - 160), glm::vec2(400, 40));
 
@@ -45,7 +44,6 @@ PlayMode::PlayMode(Client &client_) : drawable_size({1280U, 720U}), client(clien
 		glm::vec2(),
 		glm::vec2()
 	}, TileDrawer::MAP);
-	tile_drawer.update_vertices(TileDrawer::MAP);
 	map_components.push_back(index);
 	collider.add_component(glm::vec2(drawable_size.x / 2 + 500, drawable_size.y - 250), glm::vec2(400, 40));
 
@@ -55,7 +53,6 @@ PlayMode::PlayMode(Client &client_) : drawable_size({1280U, 720U}), client(clien
 		glm::vec2(),
 		glm::vec2()
 	}, TileDrawer::MAP);
-	tile_drawer.update_vertices(TileDrawer::MAP);
 	map_components.push_back(index);
 	collider.add_component(glm::vec2(drawable_size.x / 2 - 500, drawable_size.y - 250), glm::vec2(400, 40));
 
@@ -65,7 +62,6 @@ PlayMode::PlayMode(Client &client_) : drawable_size({1280U, 720U}), client(clien
 		glm::vec2(),
 		glm::vec2()
 	}, TileDrawer::MAP);
-	tile_drawer.update_vertices(TileDrawer::MAP);
 	map_components.push_back(index);
 	collider.add_component(glm::vec2(drawable_size.x / 2 + 60, drawable_size.y - 480), glm::vec2(40, 400));
 
@@ -75,9 +71,10 @@ PlayMode::PlayMode(Client &client_) : drawable_size({1280U, 720U}), client(clien
 		glm::vec2(),
 		glm::vec2()
 	}, TileDrawer::MAP);
-	tile_drawer.update_vertices(TileDrawer::MAP);
 	map_components.push_back(index);
 	collider.add_component(glm::vec2(drawable_size.x / 2 - 60, drawable_size.y - 400), glm::vec2(40, 400));
+	// map components are sorted into chunks on upload, so push them all at once
+	tile_drawer.update_vertices(TileDrawer::MAP);
 
 	index = tile_drawer.add_component(TileDrawer::Square{
 		glm::vec2(drawable_size.x / 2 + 50, drawable_size.y - 60),
@@ -183,7 +180,7 @@ void PlayMode::update(float elapsed) {
 		}
 	}
 
-	tile_drawer.components[TileDrawer::CHARACTER][self_index].position = player.position;
+	tile_drawer.edit_component(self_index, TileDrawer::CHARACTER).position = player.position;
 
 	//queue data for sending to server:
 	//TODO: send something that makes sense for your game
@@ -237,7 +234,8 @@ void PlayMode::update(float elapsed) {
 
 void PlayMode::draw(glm::uvec2 const &_drawable_size) {
 	glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT);
+	glClearDepth(1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	drawable_size = {static_cast<float>(_drawable_size.x), static_cast<float>(_drawable_size.y)};
 	tile_drawer.update_drawable_size(_drawable_size);
@@ -1,15 +1,195 @@
 #include "Scene.hpp"
 
 #include "gl_errors.hpp"
+#include "JobSystem.hpp"
+#include "Load.hpp"
 #include "read_write_chunk.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <fstream>
 
 //-------------------------
 
-glm::mat4x3 Scene::Transform::make_local_to_parent() const {
+Scene::Transform Scene::Transforms::emplace(std::string const &name, Transform parent) {
+	uint32_t parent_slot = (parent ? slot(parent) : -1U);
+
+	Transform transform{ uint32_t(slots.size()) };
+	slots.emplace_back(uint32_t(ids.size()));
+	ids.emplace_back(transform.id);
+
+	names.emplace_back(add_name(name));
+	positions.emplace_back(0.0f, 0.0f, 0.0f);
+	rotations.emplace_back(1.0f, 0.0f, 0.0f, 0.0f);
+	scales.emplace_back(1.0f, 1.0f, 1.0f);
+	parents.emplace_back(parent_slot);
+	local_to_world.emplace_back(1.0f);
+	world_to_local.emplace_back(1.0f);
+	dirty.emplace_back(1);
+
+	return transform;
+}
+
+void Scene::Transforms::clear() {
+	names.clear();
+	positions.clear();
+	rotations.clear();
+	scales.clear();
+	parents.clear();
+	local_to_world.clear();
+	world_to_local.clear();
+	dirty.clear();
+	slots.clear();
+	ids.clear();
+	name_table.reset();
+	appended_name_tables.clear();
+}
+
+uint32_t Scene::Transforms::add_name(std::string const &name) {
+	if (!name_table) {
+		name_table = std::make_shared< std::vector< std::string > >();
+	} else if (name_table.use_count() > 1) {
+		//copy-on-write; indices into the old table stay valid in the clone:
+		name_table = std::make_shared< std::vector< std::string > >(*name_table);
+	}
+	name_table->emplace_back(name);
+	return uint32_t(name_table->size() - 1);
+}
+
+void Scene::Transforms::set_name(Transform transform, std::string const &name) {
+	//table entries may be shared by several slots (and copies), so renaming points at a new entry:
+	names[slot(transform)] = add_name(name);
+}
+
+uint32_t Scene::Transforms::append(Transforms const &other, uint32_t parent_slot) {
+	assert(parent_slot == -1U || parent_slot < size());
+	uint32_t slot_offset = uint32_t(size());
+	uint32_t id_offset = uint32_t(slots.size());
+
+	//plain data is copied as is:
+	positions.insert(positions.end(), other.positions.begin(), other.positions.end());
+	rotations.insert(rotations.end(), other.rotations.begin(), other.rotations.end());
+	scales.insert(scales.end(), other.scales.begin(), other.scales.end());
+	local_to_world.insert(local_to_world.end(), other.local_to_world.begin(), other.local_to_world.end());
+	world_to_local.insert(world_to_local.end(), other.world_to_local.begin(), other.world_to_local.end());
+	dirty.insert(dirty.end(), other.size(), uint8_t(1)); //world matrices change with the new parent
+
+	//indices are copied plus an offset:
+	parents.reserve(parents.size() + other.parents.size());
+	for (uint32_t p : other.parents) {
+		parents.emplace_back(p == -1U ? parent_slot : p + slot_offset);
+	}
+	ids.reserve(ids.size() + other.ids.size());
+	for (uint32_t id : other.ids) {
+		ids.emplace_back(id + id_offset);
+	}
+	slots.reserve(slots.size() + other.slots.size());
+	for (uint32_t s : other.slots) {
+		slots.emplace_back(s + slot_offset);
+	}
+
+	//names: share other's table if nothing is named yet, else copy it into ours (once per table):
+	uint32_t name_offset = 0;
+	if (!other.name_table || other.name_table == name_table) {
+		//already shared
+	} else if (!name_table || name_table->empty()) {
+		name_table = other.name_table;
+		appended_name_tables = other.appended_name_tables;
+	} else {
+		auto found = std::find_if(appended_name_tables.begin(), appended_name_tables.end(), [&other](auto const &appended){
+			return appended.first == other.name_table;
+		});
+		if (found != appended_name_tables.end()) {
+			//(a table is never changed while shared, and appended_name_tables shares it)
+			name_offset = found->second;
+		} else {
+			if (name_table.use_count() > 1) {
+				name_table = std::make_shared< std::vector< std::string > >(*name_table);
+			}
+			name_offset = uint32_t(name_table->size());
+			name_table->insert(name_table->end(), other.name_table->begin(), other.name_table->end());
+			appended_name_tables.emplace_back(other.name_table, name_offset);
+		}
+	}
+	names.reserve(names.size() + other.names.size());
+	for (uint32_t n : other.names) {
+		names.emplace_back(n + name_offset);
+	}
+
+	return id_offset;
+}
+
+Scene::Transform Scene::Transforms::parent(Transform transform) const {
+	uint32_t p = parents[slot(transform)];
+	return (p == -1U ? Transform() : handle(p));
+}
+
+void Scene::Transforms::set_parent(Transform transform, Transform parent) {
+	uint32_t s = slot(transform);
+	uint32_t p = (parent ? slot(parent) : -1U);
+	for (uint32_t a = p; a != -1U; a = parents[a]) {
+		if (a == s) throw std::runtime_error("transform '" + name(transform) + "' can't be parented to its own descendant.");
+	}
+	parents[s] = p;
+	dirty[s] = 1;
+	if (p != -1U && p > s) sort_parents_first();
+}
+
+//move values[order[i]] to values[i]:
+template< typename T >
+static void permute(std::vector< T > &values, std::vector< uint32_t > const &order) {
+	std::vector< T > sorted;
+	sorted.reserve(values.size());
+	for (uint32_t from : order) {
+		sorted.emplace_back(std::move(values[from]));
+	}
+	values = std::move(sorted);
+}
+
+void Scene::Transforms::sort_parents_first() {
+	//a parent is always shallower than its children, so a stable sort by depth puts parents first:
+	std::vector< uint32_t > depths(size(), 0);
+	for (uint32_t s = 0; s < size(); ++s) {
+		for (uint32_t a = parents[s]; a != -1U; a = parents[a]) {
+			depths[s] += 1;
+		}
+	}
+	std::vector< uint32_t > order(size());
+	for (uint32_t s = 0; s < size(); ++s) {
+		order[s] = s;
+	}
+	std::stable_sort(order.begin(), order.end(), [&depths](uint32_t a, uint32_t b){
+		return depths[a] < depths[b];
+	});
+
+	permute(names, order);
+	permute(positions, order);
+	permute(rotations, order);
+	permute(scales, order);
+	permute(parents, order);
+	permute(local_to_world, order);
+	permute(world_to_local, order);
+	permute(ids, order);
+
+	std::vector< uint32_t > new_slot(size());
+	for (uint32_t s = 0; s < size(); ++s) {
+		new_slot[order[s]] = s;
+		slots[ids[s]] = s;
+	}
+	for (auto &p : parents) {
+		if (p != -1U) p = new_slot[p];
+	}
+	std::fill(dirty.begin(), dirty.end(), uint8_t(1));
+}
+
+glm::mat4x3 Scene::Transforms::local_to_parent_at(uint32_t slot) const {
+	glm::vec3 const &position = positions[slot];
+	glm::quat const &rotation = rotations[slot];
+	glm::vec3 const &scale = scales[slot];
+
 	//compute:
 	//   translate   *   rotate    *   scale
 	// [ 1 0 0 p.x ]   [       0 ]   [ s.x 0 0 0 ]
@@ -26,7 +206,11 @@ glm::mat4x3 Scene::Transform::make_local_to_parent() const {
 	);
 }
 
-glm::mat4x3 Scene::Transform::make_parent_to_local() const {
+glm::mat4x3 Scene::Transforms::parent_to_local_at(uint32_t slot) const {
+	glm::vec3 const &position = positions[slot];
+	glm::quat const &rotation = rotations[slot];
+	glm::vec3 const &scale = scales[slot];
+
 	//compute:
 	//   1/scale       *    rot^-1   *  translate^-1
 	// [ 1/s.x 0 0 0 ]   [       0 ]   [ 0 0 0 -p.x ]
@@ -56,19 +240,63 @@ glm::mat4x3 Scene::Transform::make_parent_to_local() const {
 	);
 }
 
-glm::mat4x3 Scene::Transform::make_local_to_world() const {
-	if (!parent) {
-		return make_local_to_parent();
+bool Scene::Transforms::stale_at(uint32_t slot) const {
+	//the cached matrices are current unless this transform or an ancestor changed since the last update():
+	for (uint32_t a = slot; a != -1U; a = parents[a]) {
+		if (dirty[a]) return true;
+	}
+	return false;
+}
+
+glm::mat4x3 Scene::Transforms::make_local_to_world(Transform transform) const {
+	uint32_t s = slot(transform);
+	if (!stale_at(s)) return local_to_world[s];
+
+	if (parents[s] == -1U) {
+		return local_to_parent_at(s);
 	} else {
-		return parent->make_local_to_world() * glm::mat4(make_local_to_parent()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+		return make_local_to_world(handle(parents[s])) * glm::mat4(local_to_parent_at(s)); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
 	}
 }
-glm::mat4x3 Scene::Transform::make_world_to_local() const {
-	if (!parent) {
-		return make_parent_to_local();
+
+glm::mat4x3 Scene::Transforms::make_world_to_local(Transform transform) const {
+	uint32_t s = slot(transform);
+	if (!stale_at(s)) return world_to_local[s];
+
+	if (parents[s] == -1U) {
+		return parent_to_local_at(s);
 	} else {
-		return make_parent_to_local() * glm::mat4(parent->make_world_to_local()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+		return parent_to_local_at(s) * glm::mat4(make_world_to_local(handle(parents[s]))); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+	}
+}
+
+void Scene::Transforms::update() const {
+	//dirty flags flow down the hierarchy; parents come before their children, so one pass does it:
+	for (uint32_t s = 0; s < size(); ++s) {
+		uint32_t p = parents[s];
+		if (p != -1U) {
+			assert(p < s && "transforms are sorted parent-before-child");
+			dirty[s] |= dirty[p];
+		}
+	}
+
+	//local matrices (the quaternion-to-matrix part) don't depend on each other, so build them in parallel:
+	JobSystem::get().parallel_for(size(), 1024, [this](size_t begin, size_t end) {
+		for (size_t s = begin; s < end; ++s) {
+			if (!dirty[s]) continue;
+			local_to_world[s] = local_to_parent_at(uint32_t(s));
+			world_to_local[s] = parent_to_local_at(uint32_t(s));
+		}
+	});
+
+	//..then compose them top-down; each parent is current by the time its children read it:
+	for (uint32_t s = 0; s < size(); ++s) {
+		uint32_t p = parents[s];
+		if (!dirty[s] || p == -1U) continue;
+		local_to_world[s] = local_to_world[p] * glm::mat4(local_to_world[s]); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+		world_to_local[s] = world_to_local[s] * glm::mat4(world_to_local[p]);
 	}
+	std::fill(dirty.begin(), dirty.end(), uint8_t(0));
 }
 
 //-------------------------
@@ -80,84 +308,462 @@ glm::mat4 Scene::Camera::make_projection() const {
 //-------------------------
 
 
-void Scene::draw(Camera const &camera) const {
+glm::mat4 Scene::make_world_to_clip(Camera const &camera) const {
 	assert(camera.transform);
-	glm::mat4 world_to_clip = camera.make_projection() * glm::mat4(camera.transform->make_world_to_local());
+	return camera.make_projection() * glm::mat4(transforms.make_world_to_local(camera.transform));
+}
+
+void Scene::draw(Camera const &camera) const {
+	glm::mat4 world_to_clip = make_world_to_clip(camera);
 	glm::mat4x3 world_to_light = glm::mat4x3(1.0f);
 	draw(world_to_clip, world_to_light);
 }
 
+Scene::Frustum Scene::Frustum::from_world_to_clip(glm::mat4 const &world_to_clip) {
+	//a clip-space point is inside when -w <= x,y,z <= w; each inequality is a plane in world space
+	// (Gribb & Hartmann's extraction), built from the rows of world_to_clip:
+	auto row = [&world_to_clip](uint32_t r) {
+		return glm::vec4(world_to_clip[0][r], world_to_clip[1][r], world_to_clip[2][r], world_to_clip[3][r]);
+	};
+	glm::vec4 planes[PlaneCount] = {
+		row(3) + row(0), row(3) - row(0), //left, right
+		row(3) + row(1), row(3) - row(1), //bottom, top
+		row(3) + row(2), row(3) - row(2), //near, far
+	};
+
+	Frustum frustum;
+	for (uint32_t i = 0; i < PlaneCount; ++i) {
+		frustum.nx[i] = planes[i].x;
+		frustum.ny[i] = planes[i].y;
+		frustum.nz[i] = planes[i].z;
+		frustum.d[i] = planes[i].w;
+	}
+	return frustum;
+}
+
+bool Scene::Frustum::overlaps_box(glm::vec3 const &center, glm::vec3 const &radius) const {
+	//signed distance of the box corner furthest along each plane's normal:
+	// (planes aren't normalized, which doesn't change the sign)
+	float reach[PlaneCount];
+	for (uint32_t i = 0; i < PlaneCount; ++i) {
+		reach[i] = nx[i] * center.x + ny[i] * center.y + nz[i] * center.z + d[i]
+		         + std::abs(nx[i]) * radius.x + std::abs(ny[i]) * radius.y + std::abs(nz[i]) * radius.z;
+	}
+	bool outside = false;
+	for (uint32_t i = 0; i < PlaneCount; ++i) {
+		outside |= (reach[i] < 0.0f);
+	}
+	return !outside;
+}
+
+bool Scene::Frustum::overlaps_box(glm::mat4x3 const &object_to_world, glm::vec3 const &min, glm::vec3 const &max) const {
+	//world-space box around the transformed box: transform the center, grow the radius by |rotation * scale|:
+	glm::vec3 center = object_to_world * glm::vec4(0.5f * (max + min), 1.0f);
+	glm::vec3 half = 0.5f * (max - min);
+	glm::vec3 radius =
+		  glm::abs(object_to_world[0]) * half.x
+		+ glm::abs(object_to_world[1]) * half.y
+		+ glm::abs(object_to_world[2]) * half.z;
+	return overlaps_box(center, radius);
+}
+
+//-------------------------
+
+//n.b. declared static so they don't conflict with similarly named global variables elsewhere:
+//instance data for instanced pipelines is streamed through one buffer texture, re-specified every draw():
+static GLuint instance_buffer = 0;
+static GLuint instance_buffer_texture = 0;
+//a buffer texture can only address GL_MAX_TEXTURE_BUFFER_SIZE texels (65536 in GL 3.3, so ~10k instances);
+// frames with more instances are uploaded in "pages" of at most this many instances, one page at a time:
+static uint32_t instance_page_size = 0;
+//the "Frame" block, re-specified every draw():
+static GLuint frame_buffer = 0;
+//"Object" blocks are appended to a ring that is only orphaned when it wraps (or reallocated to grow):
+static GLuint object_buffer = 0;
+static GLsizeiptr object_buffer_capacity = 0; //in bytes
+static GLsizeiptr object_buffer_head = 0; //first byte not yet written since the last orphaning
+static GLsizeiptr object_block_stride = 0; //sizeof(ObjectBlock) rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+
+static Load< void > setup_buffers(LoadTagDefault, [](){
+	glGenBuffers(1, &instance_buffer);
+	glGenTextures(1, &instance_buffer_texture);
+	glBindTexture(GL_TEXTURE_BUFFER, instance_buffer_texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, instance_buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+	GLint max_texels = 65536; //(the GL 3.3 minimum)
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+	instance_page_size = std::max(1U, uint32_t(std::max(max_texels, GLint(0))) / Scene::Drawable::Pipeline::InstanceTexels);
+
+	glGenBuffers(1, &frame_buffer);
+	glGenBuffers(1, &object_buffer);
+
+	GLint alignment = 1;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	if (alignment < 1) alignment = 1;
+	object_block_stride = (GLsizeiptr(sizeof(Scene::ObjectBlock)) + alignment - 1) / alignment * alignment;
+
+	GL_ERRORS();
+});
+
+//drawables whose pipelines may share one instanced draw:
+static bool same_instanced_draw(Scene::DrawItem const &a_item, Scene::DrawItem const &b_item) {
+	Scene::Drawable::Pipeline const &a = a_item.drawable->pipeline;
+	Scene::Drawable::Pipeline const &b = b_item.drawable->pipeline;
+	if (a.set_uniforms || b.set_uniforms) return false; //custom uniforms would have to be set per instance
+	if (a.program != b.program || a.vao != b.vao) return false;
+	if (a.type != b.type || a_item.start != b_item.start || a_item.count != b_item.count) return false;
+	for (uint32_t i = 0; i < Scene::Drawable::Pipeline::TextureCount; ++i) {
+		if (a.textures[i].texture != b.textures[i].texture) return false;
+		if (a.textures[i].texture != 0 && a.textures[i].target != b.textures[i].target) return false;
+	}
+	return true;
+}
+
+//Pick the level of detail to draw, starting from the level drawn last time:
+// 'screen_size' is the fraction of the viewport height the drawable's bounds cover
+static uint8_t select_lod(Scene::Drawable const &drawable, float screen_size) {
+	uint32_t lod = drawable.lod;
+	//(levels may have been removed since the last draw)
+	while (lod > 0 && (lod > Scene::Drawable::LODCount || drawable.lods[lod-1].count == 0)) --lod;
+	//coarser while well below the next level's switch point:
+	while (lod < Scene::Drawable::LODCount && drawable.lods[lod].count != 0
+		&& screen_size < drawable.lods[lod].screen_size * (1.0f - Scene::LODHysteresis)) ++lod;
+	//finer while well above the current level's switch point:
+	while (lod > 0 && screen_size > drawable.lods[lod-1].screen_size * (1.0f + Scene::LODHysteresis)) --lod;
+	return uint8_t(lod);
+}
+
+uint64_t Scene::make_draw_key(Drawable::Pipeline const &pipeline, GLuint start, GLuint count, float depth) {
+	//most expensive state change in the highest bits:
+	// [ program : 16 ][ vao : 16 ][ textures : 16 ][ depth or mesh range : 16 ]
+	//(GL names rarely exceed 16 bits; if they do, keys only sort less well -- submission compares the real state)
+	uint64_t textures = 0;
+	for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+		textures ^= uint64_t(pipeline.textures[i].texture) << (4 * i);
+	}
+
+	uint32_t low;
+	if (pipeline.INSTANCES_samplerBuffer != -1U) {
+		//instances draw in one call anyway, so group by mesh range rather than depth:
+		low = (start * 2654435761U) ^ (count * 40503U) ^ uint32_t(pipeline.type);
+		low = (low ^ (low >> 16)) & 0xffff;
+	} else {
+		//non-negative floats order the same as their bit patterns, so the high bits of the view depth
+		// give a coarse front-to-back order within a state bucket:
+		if (!(depth > 0.0f)) depth = 0.0f;
+		uint32_t depth_bits;
+		static_assert(sizeof(depth_bits) == sizeof(depth), "float is 32 bits.");
+		std::memcpy(&depth_bits, &depth, sizeof(depth));
+		low = depth_bits >> 16;
+	}
+
+	return (uint64_t(pipeline.program & 0xffff) << 48)
+	     | (uint64_t(pipeline.vao & 0xffff) << 32)
+	     | ((textures & 0xffff) << 16)
+	     | uint64_t(low);
+}
+
 void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
 
-	//Iterate through all drawables, sending each one to OpenGL:
-	for (auto const &drawable : drawables) {
-		//Reference to drawable's pipeline for convenience:
-		Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
+	update_transforms();
+
+	Frustum frustum = Frustum::from_world_to_clip(world_to_clip);
+
+	//clip-space y per world unit at clip w == 1 (i.e., projection[1][1], as long as world_to_camera doesn't scale),
+	// used to estimate how much of the viewport height a drawable covers:
+	float clip_scale_y = glm::length(glm::vec3(world_to_clip[0][1], world_to_clip[1][1], world_to_clip[2][1]));
+	glm::vec4 clip_w = glm::vec4(world_to_clip[0][3], world_to_clip[1][3], world_to_clip[2][3], world_to_clip[3][3]);
+
+	//Build the render queue (a flat list of draw commands) on the job system; only submission needs the GL thread.
+
+	//Gather visible drawables, one queue entry per drawable; skipped entries get a null drawable:
+	draw_queue.resize(drawables.size());
+	JobSystem::get().parallel_for(drawables.size(), 256, [&](size_t begin, size_t end) {
+		for (size_t d = begin; d < end; ++d) {
+			Drawable const &drawable = drawables[d];
+			DrawItem &item = draw_queue[d];
+			item = DrawItem{ 0, nullptr, nullptr, 0, 0, 1, 0, 0 };
+
+			//Reference to drawable's pipeline for convenience:
+			Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
+
+			//skip any drawables without a shader program set:
+			if (pipeline.program == 0) continue;
+			//skip any drawables that don't reference any vertex array:
+			if (pipeline.vao == 0) continue;
+			//skip any drawables that don't contain any vertices:
+			if (pipeline.count == 0) continue;
+
+			assert(drawable.transform); //drawables *must* have a transform
+			glm::mat4x3 const &object_to_world = transforms.local_to_world[transforms.slot(drawable.transform)]; //current after update_transforms()
+
+			//skip any drawables with bounds outside the view:
+			if (drawable.min.x <= drawable.max.x && !frustum.overlaps_box(object_to_world, drawable.min, drawable.max)) continue;
+
+			//clip-space w of the object's origin is its distance along the view direction:
+			float depth = glm::dot(clip_w, glm::vec4(object_to_world[3], 1.0f));
+
+			//pick a level of detail from the projected size of the bounds' enclosing sphere:
+			// (each drawable is only touched by one job, so updating its 'lod' here doesn't race)
+			GLuint start = pipeline.start;
+			GLuint count = pipeline.count;
+			if (drawable.lods[0].count != 0 && drawable.min.x <= drawable.max.x) {
+				glm::vec3 center = object_to_world * glm::vec4(0.5f * (drawable.max + drawable.min), 1.0f);
+				float scale = std::max(std::max(glm::length(object_to_world[0]), glm::length(object_to_world[1])), glm::length(object_to_world[2]));
+				float radius = scale * 0.5f * glm::length(drawable.max - drawable.min);
+				float w = glm::dot(clip_w, glm::vec4(center, 1.0f));
+				//(bounds reaching past the camera plane always count as covering the whole screen)
+				float screen_size = (w > radius ? radius * clip_scale_y / w : std::numeric_limits< float >::infinity());
+				drawable.lod = select_lod(drawable, screen_size);
+				if (drawable.lod > 0) {
+					start = drawable.lods[drawable.lod-1].start;
+					count = drawable.lods[drawable.lod-1].count;
+				}
+			}
+
+			item = DrawItem{ make_draw_key(pipeline, start, count, depth), &drawable, &object_to_world, start, count, 1, 0, 0 };
+		}
+	});
+	draw_queue.erase(std::remove_if(draw_queue.begin(), draw_queue.end(), [](DrawItem const &item){
+		return item.drawable == nullptr;
+	}), draw_queue.end());
+
+	std::sort(draw_queue.begin(), draw_queue.end(), [](DrawItem const &a, DrawItem const &b){
+		return a.key < b.key;
+	});
+
+	//Merge runs of matching instanced drawables and hand out where each entry's matrices go:
+	// (every entry of an instanced run gets its own instance_base; the first also gets the run's instance_count)
+	//Runs never straddle instance pages: a run is split at instance_page_size instances, and a run that
+	// doesn't fit in what is left of the current page starts on the next one (leaving the rest unused).
+	uint32_t instance_total = 0;
+	uint32_t object_block_total = 0;
+	for (size_t i = 0; i < draw_queue.size(); /* later */) {
+		Scene::Drawable::Pipeline const &pipeline = draw_queue[i].drawable->pipeline;
+		if (pipeline.INSTANCES_samplerBuffer == -1U) {
+			if (pipeline.OBJECT_block != -1U) {
+				draw_queue[i].object_block = object_block_total++;
+			}
+			++i;
+			continue;
+		}
+		size_t end = i + 1;
+		while (end < draw_queue.size() && end - i < instance_page_size && same_instanced_draw(draw_queue[i], draw_queue[end])) ++end;
+
+		if (instance_total % instance_page_size + (end - i) > instance_page_size) {
+			instance_total += instance_page_size - instance_total % instance_page_size;
+		}
+		draw_queue[i].instance_count = uint32_t(end - i);
+		for (size_t j = i; j < end; ++j) {
+			draw_queue[j].instance_base = instance_total++;
+		}
+		i = end;
+	}
+
+	//Compute per-instance data and "Object" blocks (including normal matrices) for the whole queue in parallel:
+	instance_texels.resize(size_t(instance_total) * Drawable::Pipeline::InstanceTexels);
+	object_blocks.resize(object_block_total);
+	JobSystem::get().parallel_for(draw_queue.size(), 256, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			DrawItem const &item = draw_queue[i];
+			Scene::Drawable::Pipeline const &pipeline = item.drawable->pipeline;
+			glm::mat4 object_to_world = glm::mat4(*item.object_to_world);
+			if (pipeline.INSTANCES_samplerBuffer != -1U) {
+				glm::mat4 rows = glm::transpose(object_to_world);
+				glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(world_to_light * object_to_world)));
+				glm::mat3 normal_rows = glm::transpose(normal_to_light);
+				glm::vec4 *texels = &instance_texels[size_t(item.instance_base) * Drawable::Pipeline::InstanceTexels];
+				texels[0] = rows[0];
+				texels[1] = rows[1];
+				texels[2] = rows[2];
+				texels[3] = glm::vec4(normal_rows[0], 0.0f);
+				texels[4] = glm::vec4(normal_rows[1], 0.0f);
+				texels[5] = glm::vec4(normal_rows[2], 0.0f);
+			} else if (pipeline.OBJECT_block != -1U) {
+				glm::mat4x3 object_to_light = world_to_light * object_to_world;
+				glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(object_to_light)));
+
+				ObjectBlock &block = object_blocks[item.object_block];
+				block.OBJECT_TO_CLIP = world_to_clip * object_to_world;
+				block.OBJECT_TO_LIGHT = glm::mat4(object_to_light);
+				block.NORMAL_TO_LIGHT = glm::mat3x4(
+					glm::vec4(normal_to_light[0], 0.0f),
+					glm::vec4(normal_to_light[1], 0.0f),
+					glm::vec4(normal_to_light[2], 0.0f)
+				);
+			}
+		}
+	});
+
+	//Upload instance data one page at a time (orphaning the previous page's storage); usually there is just the one page:
+	uint32_t uploaded_page = -1U;
+	auto upload_instance_page = [&](uint32_t page) {
+		if (page == uploaded_page) return;
+		size_t begin = size_t(page) * instance_page_size * Drawable::Pipeline::InstanceTexels;
+		size_t end = std::min(instance_texels.size(), begin + size_t(instance_page_size) * Drawable::Pipeline::InstanceTexels);
+		glBindBuffer(GL_TEXTURE_BUFFER, instance_buffer);
+		glBufferData(GL_TEXTURE_BUFFER, (end - begin) * sizeof(glm::vec4), instance_texels.data() + begin, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		uploaded_page = page;
+	};
+	if (!instance_texels.empty()) {
+		upload_instance_page(0);
 
-		//skip any drawables without a shader program set:
-		if (pipeline.program == 0) continue;
-		//skip any drawables that don't reference any vertex array:
-		if (pipeline.vao == 0) continue;
-		//skip any drawables that don't contain any vertices:
-		if (pipeline.count == 0) continue;
+		glActiveTexture(GL_TEXTURE0 + Drawable::Pipeline::TextureCount);
+		glBindTexture(GL_TEXTURE_BUFFER, instance_buffer_texture);
+	}
 
+	//Upload per-frame data:
+	FrameBlock frame;
+	frame.WORLD_TO_CLIP = world_to_clip;
+	frame.WORLD_TO_LIGHT = glm::mat4(world_to_light);
+	glBindBuffer(GL_UNIFORM_BUFFER, frame_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(frame), &frame, GL_STREAM_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, FrameBinding, frame_buffer);
+
+	//Append the "Object" blocks to the ring:
+	GLsizeiptr object_blocks_offset = 0;
+	if (!object_blocks.empty()) {
+		GLsizeiptr length = GLsizeiptr(object_blocks.size()) * object_block_stride;
+		glBindBuffer(GL_UNIFORM_BUFFER, object_buffer);
+		if (length > object_buffer_capacity) {
+			//(re-)allocate with room to spare:
+			object_buffer_capacity = std::max(length, std::max< GLsizeiptr >(2 * object_buffer_capacity, 1024 * object_block_stride));
+			glBufferData(GL_UNIFORM_BUFFER, object_buffer_capacity, nullptr, GL_STREAM_DRAW);
+			object_buffer_head = 0;
+		} else if (object_buffer_head + length > object_buffer_capacity) {
+			//wrapped; orphan the storage so in-flight draws keep theirs:
+			glBufferData(GL_UNIFORM_BUFFER, object_buffer_capacity, nullptr, GL_STREAM_DRAW);
+			object_buffer_head = 0;
+		}
+		//everything after object_buffer_head is unused since the last orphaning, so it is written without syncing:
+		object_blocks_offset = object_buffer_head;
+		char *dst = static_cast< char * >(glMapBufferRange(GL_UNIFORM_BUFFER, object_blocks_offset, length,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+		if (dst) {
+			for (size_t b = 0; b < object_blocks.size(); ++b) {
+				std::memcpy(dst + b * object_block_stride, &object_blocks[b], sizeof(ObjectBlock));
+			}
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+		} else {
+			//mapping failed; lay the blocks out at the ring's stride and upload them the ordinary way:
+			std::vector< char > staging(static_cast< size_t >(length));
+			for (size_t b = 0; b < object_blocks.size(); ++b) {
+				std::memcpy(staging.data() + b * object_block_stride, &object_blocks[b], sizeof(ObjectBlock));
+			}
+			glBufferSubData(GL_UNIFORM_BUFFER, object_blocks_offset, length, staging.data());
+		}
+		object_buffer_head += length;
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	//State currently bound, so that unchanged state isn't set again:
+	GLuint current_program = 0;
+	GLuint current_vao = 0;
+	Drawable::Pipeline::TextureInfo bound[Drawable::Pipeline::TextureCount];
+	uint32_t active_unit = 0;
+	glActiveTexture(GL_TEXTURE0);
+
+	//Iterate through the sorted queue, sending each drawable (or instanced run) to OpenGL:
+	for (size_t i = 0; i < draw_queue.size(); i += draw_queue[i].instance_count) {
+		DrawItem const &item = draw_queue[i];
+		Scene::Drawable::Pipeline const &pipeline = item.drawable->pipeline;
 
 		//Set shader program:
-		glUseProgram(pipeline.program);
+		bool program_changed = (pipeline.program != current_program);
+		if (program_changed) {
+			glUseProgram(pipeline.program);
+			current_program = pipeline.program;
+		}
 
 		//Set attribute sources:
-		glBindVertexArray(pipeline.vao);
+		if (pipeline.vao != current_vao) {
+			glBindVertexArray(pipeline.vao);
+			current_vao = pipeline.vao;
+		}
 
 		//Configure program uniforms:
 
-		//the object-to-world matrix is used in all three of these uniforms:
-		assert(drawable.transform); //drawables *must* have a transform
-		glm::mat4x3 object_to_world = drawable.transform->make_local_to_world();
+		if (pipeline.INSTANCES_samplerBuffer != -1U) {
+			//per-object matrices come from the instance buffer:
+			if (program_changed) {
+				glUniform1i(pipeline.INSTANCES_samplerBuffer, Drawable::Pipeline::TextureCount);
+			}
+			upload_instance_page(item.instance_base / instance_page_size);
+			if (pipeline.INSTANCE_BASE_int != -1U) {
+				glUniform1i(pipeline.INSTANCE_BASE_int, GLint(item.instance_base % instance_page_size));
+			}
+		} else if (pipeline.OBJECT_block != -1U) {
+			//per-object matrices were written to the ring above:
+			glBindBufferRange(GL_UNIFORM_BUFFER, ObjectBinding, object_buffer,
+				object_blocks_offset + GLintptr(item.object_block) * object_block_stride, sizeof(ObjectBlock));
+		} else {
+			//the object-to-world matrix is used in all three of these uniforms:
+			glm::mat4x3 const &object_to_world = *item.object_to_world;
 
-		//OBJECT_TO_CLIP takes vertices from object space to clip space:
-		if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
-			glm::mat4 object_to_clip = world_to_clip * glm::mat4(object_to_world);
-			glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
-		}
+			//OBJECT_TO_CLIP takes vertices from object space to clip space:
+			if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
+				glm::mat4 object_to_clip = world_to_clip * glm::mat4(object_to_world);
+				glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
+			}
 
-		//the object-to-light matrix is used in the next two uniforms:
-		glm::mat4x3 object_to_light = world_to_light * glm::mat4(object_to_world);
+			//the object-to-light matrix is used in the next two uniforms:
+			glm::mat4x3 object_to_light = world_to_light * glm::mat4(object_to_world);
 
-		//OBJECT_TO_CLIP takes vertices from object space to light space:
-		if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
-			glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
-		}
+			//OBJECT_TO_CLIP takes vertices from object space to light space:
+			if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
+				glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
+			}
 
-		//NORMAL_TO_CLIP takes normals from object space to light space:
-		if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
-			glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(object_to_light)));
-			glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
+			//NORMAL_TO_CLIP takes normals from object space to light space:
+			if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
+				glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(object_to_light)));
+				glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
+			}
 		}
 
 		//set any requested custom uniforms:
 		if (pipeline.set_uniforms) pipeline.set_uniforms();
 
-		//set up textures:
-		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, pipeline.textures[i].texture);
+		//set up textures (units this drawable doesn't use are left empty, as they would be without sorting):
+		for (uint32_t t = 0; t < Drawable::Pipeline::TextureCount; ++t) {
+			Drawable::Pipeline::TextureInfo const &want = pipeline.textures[t];
+			if (want.texture == bound[t].texture && (want.texture == 0 || want.target == bound[t].target)) continue;
+			if (active_unit != t) {
+				glActiveTexture(GL_TEXTURE0 + t);
+				active_unit = t;
+			}
+			//clear the old binding unless the new one replaces it on the same target:
+			if (bound[t].texture != 0 && (want.texture == 0 || bound[t].target != want.target)) {
+				glBindTexture(bound[t].target, 0);
+			}
+			if (want.texture != 0) {
+				glBindTexture(want.target, want.texture);
 			}
+			bound[t] = want;
 		}
 
-		//draw the object:
-		glDrawArrays(pipeline.type, pipeline.start, pipeline.count);
-
-		//un-bind textures:
-		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, 0);
-			}
+		//draw the object(s):
+		if (pipeline.INSTANCES_samplerBuffer != -1U) {
+			glDrawArraysInstanced(pipeline.type, item.start, item.count, item.instance_count);
+		} else {
+			glDrawArrays(pipeline.type, item.start, item.count);
 		}
-		glActiveTexture(GL_TEXTURE0);
+	}
 
+	//un-bind textures:
+	for (uint32_t t = 0; t < Drawable::Pipeline::TextureCount; ++t) {
+		if (bound[t].texture != 0) {
+			glActiveTexture(GL_TEXTURE0 + t);
+			glBindTexture(bound[t].target, 0);
+		}
+	}
+	if (!instance_texels.empty()) {
+		glActiveTexture(GL_TEXTURE0 + Drawable::Pipeline::TextureCount);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
 	}
+	glActiveTexture(GL_TEXTURE0);
 
 	glUseProgram(0);
 	glBindVertexArray(0);
@@ -167,7 +773,7 @@ void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_lig
 
 
 void Scene::load(std::string const &filename,
-	std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable) {
+	std::function< void(Scene &, Transform, std::string const &) > const &on_drawable) {
 
 	std::ifstream file(filename, std::ios::binary);
 
@@ -221,28 +827,26 @@ void Scene::load(std::string const &filename,
 	//--------------------------------
 	//Now that file is loaded, create transforms for hierarchy entries:
 
-	std::vector< Transform * > hierarchy_transforms;
+	std::vector< Transform > hierarchy_transforms;
 	hierarchy_transforms.reserve(hierarchy.size());
 
 	for (auto const &h : hierarchy) {
-		transforms.emplace_back();
-		Transform *t = &transforms.back();
+		Transform parent;
 		if (h.parent != -1U) {
 			if (h.parent >= hierarchy_transforms.size()) {
 				throw std::runtime_error("scene file '" + filename + "' did not contain transforms in topological-sort order.");
 			}
-			t->parent = hierarchy_transforms[h.parent];
+			parent = hierarchy_transforms[h.parent];
 		}
 
-		if (h.name_begin <= h.name_end && h.name_end <= names.size()) {
-			t->name = std::string(names.begin() + h.name_begin, names.begin() + h.name_end);
-		} else {
+		if (!(h.name_begin <= h.name_end && h.name_end <= names.size())) {
 				throw std::runtime_error("scene file '" + filename + "' contains hierarchy entry with invalid name indices");
 		}
 
-		t->position = h.position;
-		t->rotation = h.rotation;
-		t->scale = h.scale;
+		Transform t = transforms.emplace(std::string(names.begin() + h.name_begin, names.begin() + h.name_end), parent);
+		transforms.position(t) = h.position;
+		transforms.rotation(t) = h.rotation;
+		transforms.scale(t) = h.scale;
 
 		hierarchy_transforms.emplace_back(t);
 	}
@@ -314,7 +918,7 @@ void Scene::load(std::string const &filename,
 
 //-------------------------
 
-Scene::Scene(std::string const &filename, std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable) {
+Scene::Scene(std::string const &filename, std::function< void(Scene &, Transform, std::string const &) > const &on_drawable) {
 	load(filename, on_drawable);
 }
 
@@ -327,51 +931,38 @@ Scene &Scene::operator=(Scene const &other) {
 	return *this;
 }
 
-void Scene::set(Scene const &other, std::unordered_map< Transform const *, Transform * > *transform_map_) {
-
-	std::unordered_map< Transform const *, Transform * > t2t_temp;
-	std::unordered_map< Transform const *, Transform * > &transform_to_transform = *(transform_map_ ? transform_map_ : &t2t_temp);
-
-	transform_to_transform.clear();
+void Scene::set(Scene const &other) {
+	//transform handles index the copied arrays the same way they index other's, so nothing needs fixing up:
+	// (and the arrays are plain data, names included, so this is a few memcpys)
+	transforms = other.transforms;
+	drawables = other.drawables;
+	cameras = other.cameras;
+	lights = other.lights;
+}
 
-	//null transform maps to itself:
-	transform_to_transform.insert(std::make_pair(nullptr, nullptr));
+uint32_t Scene::append(Scene const &other) {
+	return append(other, Transform());
+}
 
-	//Copy transforms and store mapping:
-	transforms.clear();
-	for (auto const &t : other.transforms) {
-		transforms.emplace_back();
-		transforms.back().name = t.name;
-		transforms.back().position = t.position;
-		transforms.back().rotation = t.rotation;
-		transforms.back().scale = t.scale;
-		transforms.back().parent = t.parent; //will update later
+uint32_t Scene::append(Scene const &other, Transform parent) {
+	//n.b. appending a scene to itself would read the arrays while growing them:
+	assert(&other != this);
 
-		//store mapping between transforms old and new:
-		auto ret = transform_to_transform.insert(std::make_pair(&t, &transforms.back()));
-		assert(ret.second);
-	}
+	uint32_t offset = transforms.append(other.transforms, parent ? transforms.slot(parent) : -1U);
 
-	//update transform parents:
-	for (auto &t : transforms) {
-		t.parent = transform_to_transform.at(t.parent);
+	//copy objects, shifting their handles:
+	for (auto const &drawable : other.drawables) {
+		drawables.emplace_back(drawable);
+		drawables.back().transform.id += offset;
 	}
-
-	//copy other's drawables, updating transform pointers:
-	drawables = other.drawables;
-	for (auto &d : drawables) {
-		d.transform = transform_to_transform.at(d.transform);
+	for (auto const &camera : other.cameras) {
+		cameras.emplace_back(camera);
+		cameras.back().transform.id += offset;
 	}
-
-	//copy other's cameras, updating transform pointers:
-	cameras = other.cameras;
-	for (auto &c : cameras) {
-		c.transform = transform_to_transform.at(c.transform);
+	for (auto const &light : other.lights) {
+		lights.emplace_back(light);
+		lights.back().transform.id += offset;
 	}
 
-	//copy other's lights, updating transform pointers:
-	lights = other.lights;
-	for (auto &l : lights) {
-		l.transform = transform_to_transform.at(l.transform);
-	}
+	return offset;
 }
@@ -15,44 +15,104 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 
-#include <list>
+#include <deque>
+#include <limits>
 #include <memory>
 #include <functional>
 #include <string>
 #include <vector>
-#include <unordered_map>
 
 struct Scene {
+	//Transforms are stored structure-of-arrays in Scene::transforms (see 'Transforms' below);
+	// everything else refers to them through stable handles, which stay valid when the arrays get re-sorted:
 	struct Transform {
-		//Transform names are useful for debugging and looking up locations in a loaded scene:
-		std::string name;
+		uint32_t id = -1U; //index into Transforms::slots; -1U is the null handle
+		explicit operator bool() const { return id != -1U; }
+		bool operator==(Transform const &other) const { return id == other.id; }
+		bool operator!=(Transform const &other) const { return id != other.id; }
+	};
+
+	struct Transforms {
+		//per-slot data; slots are sorted so that every parent comes before its children:
+		std::vector< uint32_t > names; //index into name_table (see below)
+		std::vector< glm::vec3 > positions;
+		std::vector< glm::quat > rotations;
+		std::vector< glm::vec3 > scales;
+		std::vector< uint32_t > parents; //slot of the parent transform, or -1U for none
+
+		//cached world matrices, rebuilt by update() for slots marked dirty (and their descendants):
+		// (the non-const accessors below mark the slot dirty; writing the arrays directly needs mark_dirty)
+		mutable std::vector< glm::mat4x3 > local_to_world;
+		mutable std::vector< glm::mat4x3 > world_to_local;
+		mutable std::vector< uint8_t > dirty;
+
+		//handle id <-> slot:
+		std::vector< uint32_t > slots; //slot of each handle id
+		std::vector< uint32_t > ids; //handle id of each slot
+
+		//Names are useful for debugging and looking up locations in a loaded scene.
+		//They live in an append-only table that copies of the transforms share (and clone before adding to it
+		// while shared), so every per-slot array above is plain data and copying transforms never copies strings:
+		std::shared_ptr< std::vector< std::string > > name_table;
+		//tables of other Transforms already copied into name_table by append(), and the index they start at:
+		std::vector< std::pair< std::shared_ptr< std::vector< std::string > >, uint32_t > > appended_name_tables;
+
+		//add a transform (always after its parent, so slot order stays parent-before-child):
+		Transform emplace(std::string const &name, Transform parent);
+		Transform emplace(std::string const &name = std::string()) { return emplace(name, Transform{ -1U }); }
+		void clear();
+
+		//add copies of all of other's transforms after the existing ones, re-rooting other's roots under parent_slot;
+		// per-slot arrays are copied wholesale and offset, nothing is looked up. Returns the offset added to other's handle ids:
+		uint32_t append(Transforms const &other, uint32_t parent_slot = -1U);
 
-		//The core function of a transform is to store a transformation in the world:
-		glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f);
-		glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f); //n.b. wxyz init order
-		glm::vec3 scale = glm::vec3(1.0f, 1.0f, 1.0f);
+		size_t size() const { return ids.size(); }
+		uint32_t slot(Transform transform) const { assert(transform.id < slots.size()); return slots[transform.id]; }
+		Transform handle(uint32_t slot) const { assert(slot < ids.size()); return Transform{ ids[slot] }; }
 
-		//The transform above may be relative to some parent transform:
-		Transform *parent = nullptr;
+		//per-transform access:
+		std::string const &name(Transform transform) const { return (*name_table)[names[slot(transform)]]; }
+		void set_name(Transform transform, std::string const &name);
+		glm::vec3 &position(Transform transform) { return positions[mark_dirty(transform)]; }
+		glm::vec3 const &position(Transform transform) const { return positions[slot(transform)]; }
+		glm::quat &rotation(Transform transform) { return rotations[mark_dirty(transform)]; } //n.b. glm::quat is wxyz init order
+		glm::quat const &rotation(Transform transform) const { return rotations[slot(transform)]; }
+		glm::vec3 &scale(Transform transform) { return scales[mark_dirty(transform)]; }
+		glm::vec3 const &scale(Transform transform) const { return scales[slot(transform)]; }
+		uint32_t mark_dirty(Transform transform) { uint32_t s = slot(transform); dirty[s] = 1; return s; }
 
-		//It is often convenient to construct matrices representing this transformation:
+		//the transform may be relative to some parent transform:
+		Transform parent(Transform transform) const;
+		//re-parenting under a later slot re-sorts the arrays (handles stay valid, slots do not):
+		void set_parent(Transform transform, Transform parent);
+
+		//It is often convenient to construct matrices representing a transformation:
 		// ..relative to its parent:
-		glm::mat4x3 make_local_to_parent() const;
-		glm::mat4x3 make_parent_to_local() const;
-		// ..relative to the world:
-		glm::mat4x3 make_local_to_world() const;
-		glm::mat4x3 make_world_to_local() const;
-
-		//since hierarchy is tracked through pointers, copy-constructing a transform  is not advised:
-		Transform(Transform const &) = delete;
-		//if we delete some constructors, we need to let the compiler know that the default constructor is still okay:
-		Transform() = default;
+		glm::mat4x3 make_local_to_parent(Transform transform) const { return local_to_parent_at(slot(transform)); }
+		glm::mat4x3 make_parent_to_local(Transform transform) const { return parent_to_local_at(slot(transform)); }
+		// ..relative to the world (cached matrices unless something on the way to the root is dirty):
+		glm::mat4x3 make_local_to_world(Transform transform) const;
+		glm::mat4x3 make_world_to_local(Transform transform) const;
+
+		//rebuild the cached world matrices in one linear, top-down pass over the slots:
+		void update() const;
+
+		//the same matrices, by slot:
+		glm::mat4x3 local_to_parent_at(uint32_t slot) const;
+		glm::mat4x3 parent_to_local_at(uint32_t slot) const;
+	private:
+		//is this slot or one of its ancestors dirty (i.e., are its cached matrices out of date)?
+		bool stale_at(uint32_t slot) const;
+		//restore parent-before-child slot order after set_parent broke it:
+		void sort_parents_first();
+		//add a name to name_table (cloning it first if it is shared), returning its index:
+		uint32_t add_name(std::string const &name);
 	};
 
 	struct Drawable {
 		//a 'Drawable' attaches attribute data to a transform:
-		Drawable(Transform *transform_) : transform(transform_) { assert(transform); }
-		Transform * transform;
+		Drawable(Transform transform_) : transform(transform_) { assert(transform); }
+		Transform transform;
 
 		//Contains all the data needed to run the OpenGL pipeline:
 		struct Pipeline {
@@ -70,8 +130,21 @@ struct Scene {
 			GLuint OBJECT_TO_LIGHT_mat4x3 = -1U; //uniform location for object to light space (== world space) matrix
 			GLuint NORMAL_TO_LIGHT_mat3 = -1U; //uniform location for normal to light space (== world space) matrix
 
+			//..or, for programs that declare the "Object" uniform block (see Scene::ObjectBlock),
+			// the same matrices get written into a uniform buffer ring and bound with a per-draw offset:
+			GLuint OBJECT_block = -1U; //index of the program's "Object" uniform block
+
 			std::function< void() > set_uniforms; //(optional) function to set any other useful uniforms
 
+			//instancing (optional): programs that read their per-object matrices from a buffer texture set
+			// INSTANCES_samplerBuffer, and get drawn with glDrawArraysInstanced; drawables sharing program,
+			// vao, type, start, count, and textures (and without set_uniforms) become instances of one draw.
+			//INSTANCES holds InstanceTexels RGBA32F texels per instance: rows of object_to_world, then rows of normal_to_light
+			// (world to clip/light matrices come from the "Frame" uniform block, see Scene::FrameBlock)
+			enum : uint32_t { InstanceTexels = 6 };
+			GLuint INSTANCES_samplerBuffer = -1U; //uniform location for the instance buffer texture
+			GLuint INSTANCE_BASE_int = -1U; //uniform location for the index of the draw's first instance in INSTANCES
+
 			//texture objects to bind for the first TextureCount textures:
 			enum : uint32_t { TextureCount = 4 };
 			struct TextureInfo {
@@ -79,12 +152,48 @@ struct Scene {
 				GLenum target = GL_TEXTURE_2D;
 			} textures[TextureCount];
 		} pipeline;
+
+		//object-space bounding box (e.g., copied from Mesh::min/max), used to cull drawables outside the view:
+		// (the default, empty box means "unknown" and is never culled)
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+
+		//levels of detail (optional; e.g., copied from Mesh::lods): coarser vertex ranges drawn instead of
+		// pipeline.start/count once the bounding box covers less than lods[i].screen_size of the viewport height.
+		//Needs bounds (min/max); unused entries have count == 0:
+		enum : uint32_t { LODCount = 3 };
+		struct LOD {
+			GLuint start = 0;
+			GLuint count = 0;
+			float screen_size = 0.0f;
+		} lods[LODCount];
+		//level drawn last time (0 is pipeline.start/count); draw() only moves to another level once the size is
+		// LODHysteresis past its switch point, so drawables near a switch point don't flicker between levels:
+		mutable uint8_t lod = 0;
+	};
+	static constexpr float LODHysteresis = 0.1f;
+
+	//A view frustum as six planes, each with the inside where dot(n, p) + d >= 0.
+	//Planes are stored one array per component so the per-plane tests run as straight-line,
+	// vectorizable loops (no intrinsics, so it builds the same on every target):
+	struct Frustum {
+		enum : uint32_t { PlaneCount = 6 };
+		float nx[PlaneCount], ny[PlaneCount], nz[PlaneCount], d[PlaneCount];
+
+		//extract the planes of a world_to_clip matrix (e.g., Camera::make_projection() * world_to_camera);
+		// with an infinite projection the far plane comes out as "always inside":
+		static Frustum from_world_to_clip(glm::mat4 const &world_to_clip);
+
+		//might any part of a world-space box, given as center and half-size, be inside?
+		bool overlaps_box(glm::vec3 const &center, glm::vec3 const &radius) const;
+		//..same for an object-space box under an object_to_world transform:
+		bool overlaps_box(glm::mat4x3 const &object_to_world, glm::vec3 const &min, glm::vec3 const &max) const;
 	};
 
 	struct Camera {
 		//a 'Camera' attaches camera data to a transform:
-		Camera(Transform *transform_) : transform(transform_) { assert(transform); }
-		Transform * transform;
+		Camera(Transform transform_) : transform(transform_) { assert(transform); }
+		Transform transform;
 		//NOTE: cameras are directed along their -z axis
 
 		//perspective camera parameters:
@@ -97,8 +206,8 @@ struct Scene {
 
 	struct Light {
 		//a 'Light' attaches light data to a transform:
-		Light(Transform *transform_) : transform(transform_) { assert(transform); }
-		Transform * transform;
+		Light(Transform transform_) : transform(transform_) { assert(transform); }
+		Transform transform;
 		//NOTE: directional, spot, and hemisphere lights are directed along their -z axis
 
 		enum Type : char {
@@ -117,37 +226,93 @@ struct Scene {
 	};
 
 	//Scenes, of course, may have many of the above objects:
-	std::list< Transform > transforms;
-	std::list< Drawable > drawables;
-	std::list< Camera > cameras;
-	std::list< Light > lights;
+	// (deques, so adding objects doesn't move existing ones and pointers to them stay valid)
+	Transforms transforms;
+	std::deque< Drawable > drawables;
+	std::deque< Camera > cameras;
+	std::deque< Light > lights;
+
+	//Bring every transform's cached world matrices up to date in one top-down pass:
+	void update_transforms() const { transforms.update(); }
+
+	//projection * view for one of this scene's cameras:
+	glm::mat4 make_world_to_clip(Camera const &camera) const;
 
 	//The "draw" function provides a convenient way to pass all the things in a scene to OpenGL:
+	// (it runs update_transforms itself; the camera must belong to this scene)
 	void draw(Camera const &camera) const;
 
 	//..sometimes, you want to draw with a custom projection matrix and/or light space:
 	void draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f)) const;
 
+	//Uniform blocks filled by draw(); programs attach their blocks to these binding points with glUniformBlockBinding:
+	// (TileDrawer's camera block uses binding 0)
+	enum : GLuint { FrameBinding = 1, ObjectBinding = 2 };
+
+	//std140 layout of:  layout(std140) uniform Frame { mat4 WORLD_TO_CLIP; mat4x3 WORLD_TO_LIGHT; };
+	struct FrameBlock {
+		glm::mat4 WORLD_TO_CLIP;
+		glm::mat4 WORLD_TO_LIGHT; //mat4x3 with its columns padded to vec4
+	};
+	static_assert(sizeof(FrameBlock) == 64 + 64, "FrameBlock matches std140.");
+
+	//std140 layout of:  layout(std140) uniform Object { mat4 OBJECT_TO_CLIP; mat4x3 OBJECT_TO_LIGHT; mat3 NORMAL_TO_LIGHT; };
+	struct ObjectBlock {
+		glm::mat4 OBJECT_TO_CLIP;
+		glm::mat4 OBJECT_TO_LIGHT; //mat4x3 with its columns padded to vec4
+		glm::mat3x4 NORMAL_TO_LIGHT; //mat3 with its columns padded to vec4
+	};
+	static_assert(sizeof(ObjectBlock) == 64 + 64 + 48, "ObjectBlock matches std140.");
+
+	//draw() prepares everything but the GL calls on the JobSystem.
+	//It skips drawables whose bounds are outside the frustum of world_to_clip,
+	// then submits through a render queue sorted by (program, vao, textures, depth) keys,
+	// so drawables sharing state are drawn together and only state that changes gets set.
+	//Keys keep only the low 16 bits of the program, vao, and (xor-folded) texture names:
+	// submission compares the real state, so larger names still draw correctly, just sorted less well.
+	//Instanced pipelines replace depth with the mesh range in their keys, so instances of a mesh end up adjacent;
+	// the range is that of the level of detail picked for the drawable (see Drawable::lods),
+	// so only instances at the same level merge.
+	struct DrawItem {
+		uint64_t key;
+		Drawable const *drawable;
+		glm::mat4x3 const *object_to_world;
+		GLuint start, count; //vertex range of the level of detail picked for this draw
+		uint32_t instance_count; //set on the first item of an instanced draw: items [this, this + instance_count)
+		uint32_t instance_base; //where the item's matrices are in the instance buffer (the first item's is the draw's base)
+		uint32_t object_block; //index in object_blocks, for pipelines with an "Object" block
+	};
+	static uint64_t make_draw_key(Drawable::Pipeline const &pipeline, GLuint start, GLuint count, float depth);
+	mutable std::vector< DrawItem > draw_queue; //scratch space reused by draw()
+	mutable std::vector< glm::vec4 > instance_texels; //scratch space reused by draw()
+	mutable std::vector< ObjectBlock > object_blocks; //scratch space reused by draw()
+
 	//add transforms/objects/cameras from a scene file to this scene:
 	// the 'on_drawable' callback gives your code a chance to look up mesh data and make Drawables:
 	// throws on file format errors
 	void load(std::string const &filename,
-		std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable = nullptr
+		std::function< void(Scene &, Transform, std::string const &) > const &on_drawable = nullptr
 	);
 
 	//this function is called to read extra chunks from the scene file after the main chunks are read:
 	// this is useful if you, e.g., subclassing scene to represent a game level/area
-	virtual void load_extra(std::istream &from, std::vector< char > const &str0, std::vector< Transform * > const &xfh0) { }
+	virtual void load_extra(std::istream &from, std::vector< char > const &str0, std::vector< Transform > const &xfh0) { }
 
 	//empty scene:
 	Scene() = default;
 
 	//load a scene:
-	Scene(std::string const &filename, std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable);
+	Scene(std::string const &filename, std::function< void(Scene &, Transform, std::string const &) > const &on_drawable);
 
-	//copy a scene (with proper pointer fixup):
+	//copy a scene (handles are indices, so the copy's drawables/cameras/lights refer to the copied transforms as is):
 	Scene(Scene const &); //...as a constructor
 	Scene &operator=(Scene const &); //...as scene = scene
-	//... as a set() function that optionally returns the transform->transform mapping:
-	void set(Scene const &, std::unordered_map< Transform const *, Transform * > *transform_map = nullptr);
+	//... as a set() function:
+	void set(Scene const &);
+
+	//add a copy of another scene (e.g., a prefab) to this one, with its root transforms placed under 'parent';
+	// the copied objects keep other's handles shifted by the returned offset, i.e. other's transform id
+	// 'i' is Transform{ i + offset } in this scene:
+	uint32_t append(Scene const &other);
+	uint32_t append(Scene const &other, Transform parent);
 };
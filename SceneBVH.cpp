@@ -0,0 +1,237 @@
+#include "SceneBVH.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+static float surface_area(glm::vec3 const &min, glm::vec3 const &max) {
+	glm::vec3 size = glm::max(max - min, glm::vec3(0.0f));
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+void SceneBVH::compute_item_bounds(Scene const &scene) {
+	item_min.resize(scene.drawables.size());
+	item_max.resize(scene.drawables.size());
+	for (size_t d = 0; d < scene.drawables.size(); ++d) {
+		Scene::Drawable const &drawable = scene.drawables[d];
+		glm::mat4x3 const &object_to_world = scene.transforms.local_to_world[scene.transforms.slot(drawable.transform)];
+		if (!(drawable.min.x <= drawable.max.x)) {
+			item_min[d] = item_max[d] = object_to_world[3];
+			continue;
+		}
+		//world-space box around the transformed box (same as Scene::Frustum::overlaps_box):
+		glm::vec3 center = object_to_world * glm::vec4(0.5f * (drawable.max + drawable.min), 1.0f);
+		glm::vec3 half = 0.5f * (drawable.max - drawable.min);
+		glm::vec3 radius =
+			  glm::abs(object_to_world[0]) * half.x
+			+ glm::abs(object_to_world[1]) * half.y
+			+ glm::abs(object_to_world[2]) * half.z;
+		item_min[d] = center - radius;
+		item_max[d] = center + radius;
+	}
+}
+
+void SceneBVH::build(Scene const &scene) {
+	compute_item_bounds(scene);
+
+	items.resize(scene.drawables.size());
+	for (uint32_t i = 0; i < items.size(); ++i) {
+		items[i] = i;
+	}
+
+	nodes.clear();
+	nodes.reserve(2 * (items.size() / LeafSize + 1));
+	build_node(0, uint32_t(items.size()));
+
+	built_area = surface_area(nodes[0].min, nodes[0].max);
+}
+
+uint32_t SceneBVH::build_node(uint32_t begin, uint32_t end) {
+	uint32_t index = uint32_t(nodes.size());
+	nodes.emplace_back();
+
+	glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+	glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+	glm::vec3 center_min = min, center_max = max;
+	for (uint32_t i = begin; i < end; ++i) {
+		min = glm::min(min, item_min[items[i]]);
+		max = glm::max(max, item_max[items[i]]);
+		glm::vec3 center = 0.5f * (item_min[items[i]] + item_max[items[i]]);
+		center_min = glm::min(center_min, center);
+		center_max = glm::max(center_max, center);
+	}
+	nodes[index].min = min;
+	nodes[index].max = max;
+
+	if (end - begin <= LeafSize) {
+		nodes[index].first = begin;
+		nodes[index].count = end - begin;
+		return index;
+	}
+
+	//split at the median center along the axis where centers spread the most:
+	glm::vec3 spread = center_max - center_min;
+	uint32_t axis = 0;
+	if (spread.y > spread[axis]) axis = 1;
+	if (spread.z > spread[axis]) axis = 2;
+	uint32_t mid = begin + (end - begin) / 2;
+	std::nth_element(items.begin() + begin, items.begin() + mid, items.begin() + end, [this, axis](uint32_t a, uint32_t b){
+		return item_min[a][axis] + item_max[a][axis] < item_min[b][axis] + item_max[b][axis];
+	});
+
+	build_node(begin, mid); //left child is index + 1
+	uint32_t right = build_node(mid, end);
+	nodes[index].first = right;
+	nodes[index].count = 0;
+	return index;
+}
+
+void SceneBVH::refit(Scene const &scene) {
+	assert(scene.drawables.size() == items.size() && "refit needs the drawables the tree was built over");
+	compute_item_bounds(scene);
+
+	//children come after their parents, so walking backwards sees children first:
+	for (uint32_t n = uint32_t(nodes.size()); n > 0; --n) {
+		Node &node = nodes[n - 1];
+		if (node.count != 0) {
+			node.min = glm::vec3( std::numeric_limits< float >::infinity());
+			node.max = glm::vec3(-std::numeric_limits< float >::infinity());
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				node.min = glm::min(node.min, item_min[items[i]]);
+				node.max = glm::max(node.max, item_max[items[i]]);
+			}
+		} else {
+			Node const &left = nodes[n];
+			Node const &right = nodes[node.first];
+			node.min = glm::min(left.min, right.min);
+			node.max = glm::max(left.max, right.max);
+		}
+	}
+}
+
+void SceneBVH::update(Scene const &scene) {
+	if (nodes.empty() || scene.drawables.size() != items.size()) {
+		build(scene);
+		return;
+	}
+	refit(scene);
+	//things moved far apart since the build; the old grouping won't prune well anymore:
+	if (surface_area(nodes[0].min, nodes[0].max) > 2.0f * built_area + 1e-6f) {
+		build(scene);
+	}
+}
+
+void SceneBVH::query_box(glm::vec3 const &min, glm::vec3 const &max, std::vector< uint32_t > *found) const {
+	assert(found);
+	if (nodes.empty()) return;
+	auto overlaps = [&min, &max](glm::vec3 const &a_min, glm::vec3 const &a_max) {
+		return a_min.x <= max.x && min.x <= a_max.x
+		    && a_min.y <= max.y && min.y <= a_max.y
+		    && a_min.z <= max.z && min.z <= a_max.z;
+	};
+
+	std::vector< uint32_t > stack;
+	stack.emplace_back(0);
+	while (!stack.empty()) {
+		uint32_t n = stack.back();
+		stack.pop_back();
+		Node const &node = nodes[n];
+		if (!overlaps(node.min, node.max)) continue;
+		if (node.count != 0) {
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				if (overlaps(item_min[items[i]], item_max[items[i]])) found->emplace_back(items[i]);
+			}
+		} else {
+			stack.emplace_back(node.first);
+			stack.emplace_back(n + 1);
+		}
+	}
+}
+
+void SceneBVH::query_frustum(Scene::Frustum const &frustum, std::vector< uint32_t > *found) const {
+	assert(found);
+	if (nodes.empty()) return;
+	auto inside = [&frustum](glm::vec3 const &min, glm::vec3 const &max) {
+		return frustum.overlaps_box(0.5f * (max + min), 0.5f * (max - min));
+	};
+
+	std::vector< uint32_t > stack;
+	stack.emplace_back(0);
+	while (!stack.empty()) {
+		uint32_t n = stack.back();
+		stack.pop_back();
+		Node const &node = nodes[n];
+		if (!inside(node.min, node.max)) continue;
+		if (node.count != 0) {
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				if (inside(item_min[items[i]], item_max[items[i]])) found->emplace_back(items[i]);
+			}
+		} else {
+			stack.emplace_back(node.first);
+			stack.emplace_back(n + 1);
+		}
+	}
+}
+
+bool SceneBVH::ray_cast(glm::vec3 const &origin, glm::vec3 const &direction, float max_t, uint32_t *drawable_, float *t_) const {
+	if (nodes.empty()) return false;
+
+	//slab test; returns the entry distance, or infinity on a miss:
+	// (axes the ray doesn't move along are handled separately: 1/0 slabs give 0 * inf == NaN when the origin is on a face)
+	glm::vec3 inv_direction = 1.0f / direction;
+	auto enter = [&](glm::vec3 const &min, glm::vec3 const &max, float limit) {
+		float t_enter = 0.0f;
+		float t_exit = limit;
+		for (uint32_t i = 0; i < 3; ++i) {
+			if (direction[i] == 0.0f) {
+				//parallel to this slab: inside it is no constraint, outside it is a miss:
+				if (origin[i] < min[i] || origin[i] > max[i]) return std::numeric_limits< float >::infinity();
+				continue;
+			}
+			float t0 = (min[i] - origin[i]) * inv_direction[i];
+			float t1 = (max[i] - origin[i]) * inv_direction[i];
+			t_enter = std::max(t_enter, std::min(t0, t1));
+			t_exit = std::min(t_exit, std::max(t0, t1));
+		}
+		return (t_enter <= t_exit ? t_enter : std::numeric_limits< float >::infinity());
+	};
+
+	uint32_t best = -1U;
+	float best_t = max_t;
+
+	std::vector< std::pair< float, uint32_t > > stack; //(entry distance, node)
+	float root_t = enter(nodes[0].min, nodes[0].max, best_t);
+	if (root_t != std::numeric_limits< float >::infinity()) stack.emplace_back(root_t, 0);
+	while (!stack.empty()) {
+		float node_t = stack.back().first;
+		uint32_t n = stack.back().second;
+		stack.pop_back();
+		if (node_t > best_t) continue; //something closer was found since this was pushed
+
+		Node const &node = nodes[n];
+		if (node.count != 0) {
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				float t = enter(item_min[items[i]], item_max[items[i]], best_t);
+				if (t != std::numeric_limits< float >::infinity() && (best == -1U || t < best_t)) {
+					best = items[i];
+					best_t = t;
+				}
+			}
+		} else {
+			//visit the nearer child first (pushed last):
+			float left_t = enter(nodes[n + 1].min, nodes[n + 1].max, best_t);
+			float right_t = enter(nodes[node.first].min, nodes[node.first].max, best_t);
+			if (left_t < right_t) {
+				if (right_t != std::numeric_limits< float >::infinity()) stack.emplace_back(right_t, node.first);
+				stack.emplace_back(left_t, n + 1);
+			} else {
+				if (left_t != std::numeric_limits< float >::infinity()) stack.emplace_back(left_t, n + 1);
+				if (right_t != std::numeric_limits< float >::infinity()) stack.emplace_back(right_t, node.first);
+			}
+		}
+	}
+
+	if (best == -1U) return false;
+	if (drawable_) *drawable_ = best;
+	if (t_) *t_ = best_t;
+	return true;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+/*
+ * A SceneBVH is a bounding volume hierarchy over the world-space bounds of
+ *  a Scene's drawables, for queries that would otherwise scan every drawable
+ *  (picking, proximity, line-of-sight, ...).
+ *
+ * Queries report drawables by their index in scene.drawables and test against
+ *  bounding boxes only; exact (e.g., per-triangle) tests are up to the caller.
+ *
+ * //each frame, after moving things:
+ * scene.update_transforms();
+ * bvh.update(scene); //refits, or rebuilds when needed
+ *
+ */
+
+#include "Scene.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+struct SceneBVH {
+	//Nodes are stored depth-first, so a node's left child directly follows it:
+	struct Node {
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+		uint32_t first = 0; //leaf: first entry in 'items'; inner: index of the right child
+		uint32_t count = 0; //leaf: number of items; inner: 0
+	};
+	enum : uint32_t { LeafSize = 4 }; //most items in a leaf
+
+	std::vector< Node > nodes; //nodes[0] is the root
+	std::vector< uint32_t > items; //drawable indices, grouped by leaf
+
+	//world-space bounds of every drawable, as of the last build/refit:
+	// (drawables without bounds are indexed as a point at their transform's origin)
+	std::vector< glm::vec3 > item_min, item_max;
+
+	//build from scratch; the scene's transforms must be current (see Scene::update_transforms):
+	void build(Scene const &scene);
+	//recompute node bounds for moved drawables, keeping the tree's shape; the drawable count must be unchanged:
+	void refit(Scene const &scene);
+	//refit, or rebuild if drawables were added/removed or refitting has loosened the tree too much:
+	void update(Scene const &scene);
+
+	//append the drawables whose bounds overlap a world-space box:
+	void query_box(glm::vec3 const &min, glm::vec3 const &max, std::vector< uint32_t > *found) const;
+	//append the drawables whose bounds might be inside a frustum:
+	void query_frustum(Scene::Frustum const &frustum, std::vector< uint32_t > *found) const;
+	//closest drawable whose bounds the ray origin + t * direction hits for t in [0, max_t];
+	// returns false (leaving the outputs alone) on a miss:
+	bool ray_cast(glm::vec3 const &origin, glm::vec3 const &direction, float max_t, uint32_t *drawable, float *t) const;
+
+	//-- internals ---
+	float built_area = 0.0f; //root surface area right after the last build, to judge refit quality
+	void compute_item_bounds(Scene const &scene);
+	uint32_t build_node(uint32_t begin, uint32_t end); //over items[begin, end), returns the node index
+};
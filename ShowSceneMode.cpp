@@ -2,13 +2,13 @@
 #include "DrawLines.hpp"
 
 #include <iostream>
+#include <limits>
 
 ShowSceneMode::ShowSceneMode(Scene const &scene_) : scene(scene_) {
 
 	//Set up camera-only scene:
 	{ //create a single camera:
-		camera_scene.transforms.emplace_back();
-		camera_scene.cameras.emplace_back(&camera_scene.transforms.back());
+		camera_scene.cameras.emplace_back(camera_scene.transforms.emplace("camera"));
 		scene_camera = &camera_scene.cameras.back();
 		scene_camera->fovy = 60.0f / 180.0f * 3.1415926f;
 		scene_camera->near = 0.01f;
@@ -20,6 +20,30 @@ ShowSceneMode::~ShowSceneMode() {
 }
 
 bool ShowSceneMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size) {
+	//----- picking -----
+	if (evt.type == SDL_MOUSEBUTTONDOWN && evt.button.button == SDL_BUTTON_RIGHT) {
+		//ray through the mouse position, from the near plane (clip z = -1) toward clip z = 0:
+		// (the projection is infinite, so its far plane isn't a usable endpoint)
+		glm::vec2 ndc = glm::vec2(
+			(evt.button.x + 0.5f) / float(window_size.x) * 2.0f - 1.0f,
+			(evt.button.y + 0.5f) / float(window_size.y) *-2.0f + 1.0f
+		);
+		glm::mat4 clip_to_world = glm::inverse(camera_scene.make_world_to_clip(*scene_camera));
+		glm::vec4 a = clip_to_world * glm::vec4(ndc, -1.0f, 1.0f);
+		glm::vec4 b = clip_to_world * glm::vec4(ndc, 0.0f, 1.0f);
+		glm::vec3 origin = glm::vec3(a) / a.w;
+		glm::vec3 direction = glm::vec3(b) / b.w - origin;
+
+		scene.update_transforms();
+		bvh.update(scene);
+		picked = -1U;
+		float t;
+		if (bvh.ray_cast(origin, direction, std::numeric_limits< float >::infinity(), &picked, &t)) {
+			std::cout << "Picked '" << scene.transforms.name(scene.drawables[picked].transform) << "'." << std::endl;
+		}
+		return true;
+	}
+
 	//----- trackball-style camera controls -----
 	if (evt.type == SDL_MOUSEBUTTONDOWN) {
 		if (evt.button.button == SDL_BUTTON_LEFT) {
@@ -40,7 +64,7 @@ bool ShowSceneMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_
 			if (SDL_GetModState() & KMOD_SHIFT) {
 				//shift: pan
 
-				glm::mat3 frame = glm::mat3_cast(scene_camera->transform->rotation);
+				glm::mat3 frame = glm::mat3_cast(camera_scene.transforms.rotation(scene_camera->transform));
 				camera.target -= frame[0] * (delta.x * camera.radius) + frame[1] * (delta.y * camera.radius);
 			} else {
 				//no shift: tumble
@@ -75,12 +99,13 @@ bool ShowSceneMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_
 void ShowSceneMode::draw(glm::uvec2 const &drawable_size) {
 	//--- use camera structure to set up scene camera ---
 
-	scene_camera->transform->rotation =
+	glm::quat &camera_rotation = camera_scene.transforms.rotation(scene_camera->transform);
+	camera_rotation =
 		glm::angleAxis(camera.azimuth, glm::vec3(0.0f, 0.0f, 1.0f))
 		* glm::angleAxis(0.5f * 3.1415926f + -camera.elevation, glm::vec3(1.0f, 0.0f, 0.0f))
 	;
-	scene_camera->transform->position = camera.target + camera.radius * (scene_camera->transform->rotation * glm::vec3(0.0f, 0.0f, 1.0f));
-	scene_camera->transform->scale = glm::vec3(1.0f);
+	camera_scene.transforms.position(scene_camera->transform) = camera.target + camera.radius * (camera_rotation * glm::vec3(0.0f, 0.0f, 1.0f));
+	camera_scene.transforms.scale(scene_camera->transform) = glm::vec3(1.0f);
 	scene_camera->aspect = float(drawable_size.x) / float(drawable_size.y);
 
 
@@ -91,12 +116,15 @@ void ShowSceneMode::draw(glm::uvec2 const &drawable_size) {
 	glEnable(GL_DEPTH_TEST);
 	glDepthFunc(GL_LEQUAL);
 
-	scene.draw(*scene_camera);
+	//the camera lives in camera_scene, so build its matrix there:
+	glm::mat4 world_to_clip = camera_scene.make_world_to_clip(*scene_camera);
+	scene.draw(world_to_clip);
 
 	{ //decorate with some lines:
-		DrawLines draw_lines(scene_camera->make_projection() * glm::mat4(scene_camera->transform->make_world_to_local()));
-		for (auto &transform : scene.transforms) {
-			glm::mat4 local_to_world = transform.make_local_to_world();
+		DrawLines draw_lines(world_to_clip);
+		for (uint32_t slot = 0; slot < scene.transforms.size(); ++slot) {
+			Scene::Transform transform = scene.transforms.handle(slot);
+			glm::mat4 local_to_world = scene.transforms.make_local_to_world(transform);
 			auto xf = [&local_to_world](glm::vec3 const &vec) {
 				return glm::vec3(local_to_world * glm::vec4(vec, 1.0f));
 			};
@@ -104,9 +132,9 @@ void ShowSceneMode::draw(glm::uvec2 const &drawable_size) {
 				return glm::vec3(local_to_world * glm::vec4(vec, 0.0f));
 			};
 
-			if (transform.parent) {
+			if (Scene::Transform parent = scene.transforms.parent(transform)) {
 				//connect to parent:
-				glm::vec3 p = glm::vec3(transform.parent->make_local_to_world()[3]);
+				glm::vec3 p = glm::vec3(scene.transforms.make_local_to_world(parent)[3]);
 				draw_lines.draw(p, xf(glm::vec3(0.0f)), glm::u8vec4(0xff, 0xff, 0x00, 0xff));
 			}
 
@@ -121,13 +149,25 @@ void ShowSceneMode::draw(glm::uvec2 const &drawable_size) {
 			draw_lines.draw(xf(glm::vec3(0.0f)), xf(glm::vec3(0.0f, 0.0f, -len)), glm::u8vec4(0x00, 0x00, 0x88, 0xff));
 
 			//transform name:
-			draw_lines.draw_text("'" + transform.name + "'",
+			draw_lines.draw_text("'" + scene.transforms.name(transform) + "'",
 				xf(glm::vec3(0.05f, 0.0f, 0.05f)),
 				0.15f * xfd(glm::vec3(1.0f, 0.0f, 0.0f)),
 				0.15f * xfd(glm::vec3(0.0f, 0.0f, 1.0f)),
 				glm::u8vec4(0xff, 0xff, 0xff, 0xff)
 			);
 		}
+
+		//world bounds of the picked drawable:
+		if (picked < bvh.item_min.size()) {
+			glm::vec3 r = 0.5f * (bvh.item_max[picked] - bvh.item_min[picked]);
+			glm::vec3 c = 0.5f * (bvh.item_max[picked] + bvh.item_min[picked]);
+			draw_lines.draw_box(glm::mat4x3(
+				glm::vec3(r.x,  0.0f, 0.0f),
+				glm::vec3(0.0f,  r.y, 0.0f),
+				glm::vec3(0.0f, 0.0f,  r.z),
+				c
+			), glm::u8vec4(0xff, 0x88, 0x00, 0xff));
+		}
 		/*
 		glEnable(GL_LINE_SMOOTH);
 		glEnable(GL_BLEND);
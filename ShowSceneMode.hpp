@@ -9,6 +9,7 @@
 
 #include "Mode.hpp"
 #include "Scene.hpp"
+#include "SceneBVH.hpp"
 #include "Mesh.hpp"
 
 struct ShowSceneMode : Mode {
@@ -33,4 +34,8 @@ struct ShowSceneMode : Mode {
 	//mode uses a secondary Scene to hold a camera:
 	Scene camera_scene;
 	Scene::Camera *scene_camera = nullptr;
+
+	//right-click picks the drawable under the mouse (by bounds), using a BVH over the scene:
+	SceneBVH bvh;
+	uint32_t picked = -1U; //index in scene.drawables
 };
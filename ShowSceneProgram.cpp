@@ -10,9 +10,9 @@ Load< ShowSceneProgram > show_scene_program(LoadTagEarly, []() -> ShowSceneProgr
 
 	show_scene_program_pipeline.program = ret->program;
 
-	show_scene_program_pipeline.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
-	show_scene_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
-	show_scene_program_pipeline.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
+	//drawn instanced, so repeated meshes in a scene cost one draw call:
+	show_scene_program_pipeline.INSTANCES_samplerBuffer = ret->INSTANCES_samplerBuffer;
+	show_scene_program_pipeline.INSTANCE_BASE_int = ret->INSTANCE_BASE_int;
 
 	return ret;
 });
@@ -22,9 +22,12 @@ ShowSceneProgram::ShowSceneProgram() {
 	program = gl_compile_program(
 		//vertex shader:
 		"#version 330\n"
-		"uniform mat4 OBJECT_TO_CLIP;\n"
-		"uniform mat4x3 OBJECT_TO_LIGHT;\n"
-		"uniform mat3 NORMAL_TO_LIGHT;\n"
+		"uniform samplerBuffer INSTANCES;\n"
+		"uniform int INSTANCE_BASE;\n"
+		"layout(std140) uniform Frame {\n" //see Scene::FrameBlock
+		"	mat4 WORLD_TO_CLIP;\n"
+		"	mat4x3 WORLD_TO_LIGHT;\n"
+		"};\n"
 		"in vec4 Position;\n"
 		"in vec3 Normal;\n"
 		"in vec4 Color;\n"
@@ -34,8 +37,12 @@ ShowSceneProgram::ShowSceneProgram() {
 		"out vec4 color;\n"
 		"out vec2 texCoord;\n"
 		"void main() {\n"
-		"	gl_Position = OBJECT_TO_CLIP * Position;\n"
-		"	position = OBJECT_TO_LIGHT * Position;\n"
+		"	int i = 6 * (INSTANCE_BASE + gl_InstanceID);\n" //see Scene::Drawable::Pipeline::InstanceTexels
+		"	mat4x3 OBJECT_TO_WORLD = transpose(mat3x4(texelFetch(INSTANCES, i+0), texelFetch(INSTANCES, i+1), texelFetch(INSTANCES, i+2)));\n"
+		"	mat3 NORMAL_TO_LIGHT = transpose(mat3(texelFetch(INSTANCES, i+3).xyz, texelFetch(INSTANCES, i+4).xyz, texelFetch(INSTANCES, i+5).xyz));\n"
+		"	vec4 world_position = vec4(OBJECT_TO_WORLD * Position, 1.0);\n"
+		"	gl_Position = WORLD_TO_CLIP * world_position;\n"
+		"	position = WORLD_TO_LIGHT * world_position;\n"
 		"	normal = NORMAL_TO_LIGHT * Normal;\n"
 		"	color = Color;\n"
 		"	texCoord = TexCoord;\n"
@@ -80,9 +87,11 @@ ShowSceneProgram::ShowSceneProgram() {
 	TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
 
 	//look up the locations of uniforms:
-	OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
-	OBJECT_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "OBJECT_TO_LIGHT");
-	NORMAL_TO_LIGHT_mat3 = glGetUniformLocation(program, "NORMAL_TO_LIGHT");
+	INSTANCES_samplerBuffer = glGetUniformLocation(program, "INSTANCES");
+	INSTANCE_BASE_int = glGetUniformLocation(program, "INSTANCE_BASE");
+
+	//world to clip/light matrices come from the block Scene::draw binds at Scene::FrameBinding:
+	glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Frame"), Scene::FrameBinding);
 
 	INSPECT_MODE_int = glGetUniformLocation(program, "INSPECT_MODE");
 }
@@ -20,14 +20,15 @@ struct ShowSceneProgram {
 	GLuint TexCoord_vec2 = -1U;
 
 	//Uniform (per-invocation variable) locations:
-	GLuint OBJECT_TO_CLIP_mat4 = -1U;
-	GLuint OBJECT_TO_LIGHT_mat4x3 = -1U;
-	GLuint NORMAL_TO_LIGHT_mat3 = -1U;
+	// (per-object matrices come from the instance buffer, see Scene::Drawable::Pipeline,
+	//  and world matrices from the "Frame" block, see Scene::FrameBlock)
+	GLuint INSTANCES_samplerBuffer = -1U;
+	GLuint INSTANCE_BASE_int = -1U;
 
 	GLuint INSPECT_MODE_int = -1U; //0: basic lighting; 1: position only; 2: normal only; 3: color only; 4: texcoord only
 
 	//Textures:
-	//no textures used
+	//TEXTURE4 - instance buffer texture (bound by Scene::draw)
 };
 
 extern Load< ShowSceneProgram > show_scene_program;
@@ -0,0 +1,339 @@
+#include "TextureAtlas.hpp"
+
+#include "load_save_png.hpp"
+#include "read_write_chunk.hpp"
+#include "gl_errors.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <streambuf>
+
+
+// empty texels kept around every sprite so neighbours don't bleed into each other
+static constexpr uint32_t PADDING = 1U;
+
+TextureAtlas::TextureAtlas(glm::uvec2 page_size_) : page_size(page_size_) {
+    glGenTextures(1, &texture);
+    add(WHITE, glm::uvec2(2U), std::vector<glm::u8vec4>(4, glm::u8vec4(0xff)));
+}
+
+TextureAtlas::~TextureAtlas() {
+    glDeleteTextures(1, &texture);
+}
+
+void TextureAtlas::add_page() {
+    page_count += 1;
+    pixels.resize(size_t(page_size.x) * page_size.y * page_count, glm::u8vec4(0x00));
+    skylines.emplace_back(1, Segment{0U, 0U, page_size.x});
+}
+
+bool TextureAtlas::place(std::vector<Segment> &skyline, glm::uvec2 size, glm::uvec2 *at) const {
+    // bottom-left rule: take the spot that leaves the lowest top edge
+    size_t best = skyline.size();
+    uint32_t best_y = 0U, best_top = -1U;
+    for (size_t i = 0; i < skyline.size(); ++i) {
+        uint32_t x = skyline[i].x;
+        if (x + size.x > page_size.x) break;
+        // the rectangle rests on the highest segment it spans
+        uint32_t y = 0U;
+        for (size_t j = i; j < skyline.size() && skyline[j].x < x + size.x; ++j) {
+            y = std::max(y, skyline[j].y);
+        }
+        if (y + size.y > page_size.y) continue;
+        if (y + size.y < best_top) {
+            best = i;
+            best_y = y;
+            best_top = y + size.y;
+        }
+    }
+    if (best == skyline.size()) return false;
+
+    *at = glm::uvec2(skyline[best].x, best_y);
+
+    // raise the skyline under the new rectangle, cutting back the segments it covers
+    Segment raised{at->x, best_top, size.x};
+    size_t end = best;
+    while (end < skyline.size() && skyline[end].x + skyline[end].width <= raised.x + raised.width) ++end;
+    if (end < skyline.size() && skyline[end].x < raised.x + raised.width) {
+        uint32_t cut = raised.x + raised.width - skyline[end].x;
+        skyline[end].x += cut;
+        skyline[end].width -= cut;
+    }
+    skyline.erase(skyline.begin() + best, skyline.begin() + end);
+    skyline.insert(skyline.begin() + best, raised);
+
+    // merge neighbours of equal height
+    for (size_t i = 0; i + 1 < skyline.size(); ) {
+        if (skyline[i].y == skyline[i + 1].y) {
+            skyline[i].width += skyline[i + 1].width;
+            skyline.erase(skyline.begin() + i + 1);
+        } else {
+            ++i;
+        }
+    }
+    return true;
+}
+
+TextureAtlas::Sprite const &TextureAtlas::add(std::string const &name, glm::uvec2 size, std::vector<glm::u8vec4> const &data) {
+    glm::uvec2 padded = size + 2U * PADDING;
+    if (padded.x > page_size.x || padded.y > page_size.y) {
+        throw std::runtime_error("Sprite '" + name + "' does not fit in an atlas page.");
+    }
+    if (data.size() != size_t(size.x) * size.y) {
+        throw std::runtime_error("Sprite '" + name + "' has the wrong amount of pixel data.");
+    }
+
+    // try the open pages first, then a fresh one
+    glm::uvec2 at;
+    uint32_t layer = 0;
+    while (layer < page_count && !place(skylines[layer], padded, &at)) ++layer;
+    if (layer == page_count) {
+        add_page();
+        place(skylines[layer], padded, &at);
+    }
+    at += PADDING;
+
+    // the white block is placed first, so it lands on (0,0) exactly
+    if (name == WHITE) at = glm::uvec2(0U);
+
+    glm::u8vec4 *page = pixels.data() + size_t(page_size.x) * page_size.y * layer;
+    for (uint32_t row = 0; row < size.y; ++row) {
+        std::copy(data.begin() + size_t(row) * size.x, data.begin() + size_t(row + 1) * size.x,
+            page + size_t(at.y + row) * page_size.x + at.x);
+    }
+
+    Sprite sprite;
+    sprite.uv_upper_left = glm::vec2(at) / glm::vec2(page_size);
+    sprite.uv_bottom_right = glm::vec2(at + size) / glm::vec2(page_size);
+    sprite.layer = layer;
+    return sprites[name] = sprite;
+}
+
+TextureAtlas::Sprite const &TextureAtlas::add_png(std::string const &name, std::string const &filename) {
+    glm::uvec2 size;
+    std::vector<glm::u8vec4> data;
+    load_png(filename, &size, &data, UpperLeftOrigin);
+    return add(name, size, data);
+}
+
+TextureAtlas::Sprite const &TextureAtlas::lookup(std::string const &name) const {
+    auto it = sprites.find(name);
+    if (it == sprites.end()) {
+        throw std::runtime_error("Looking up sprite '" + name + "' that isn't in the atlas.");
+    }
+    return it->second;
+}
+
+//-------------------------
+// baked cache file, a sequence of chunks as written by write_chunk:
+
+static constexpr uint32_t CACHE_VERSION = 1U;
+
+struct CacheHeader {
+    uint32_t version;
+    uint32_t page_width, page_height, page_count;
+};
+static_assert(sizeof(CacheHeader) == 4 * 4, "CacheHeader is packed.");
+
+struct SourceEntry {
+    uint32_t name_begin, name_end;
+    uint32_t filename_begin, filename_end;
+    uint64_t size, mtime;
+};
+static_assert(sizeof(SourceEntry) == 4 * 4 + 8 * 2, "SourceEntry is packed.");
+
+struct SpriteEntry {
+    uint32_t name_begin, name_end;
+    glm::vec2 uv_upper_left, uv_bottom_right;
+    uint32_t layer;
+};
+static_assert(sizeof(SpriteEntry) == 4 * 2 + 4 * 4 + 4, "SpriteEntry is packed.");
+
+struct SegmentEntry {
+    uint32_t page, x, y, width;
+};
+static_assert(sizeof(SegmentEntry) == 4 * 4, "SegmentEntry is packed.");
+
+// size and modification time of a source file; false if it can't be read
+static bool stamp_file(std::string const &filename, uint64_t *size, uint64_t *mtime) {
+    std::error_code ec;
+    uint64_t file_size = std::filesystem::file_size(filename, ec);
+    if (ec) return false;
+    auto time = std::filesystem::last_write_time(filename, ec);
+    if (ec) return false;
+    *size = file_size;
+    *mtime = static_cast<uint64_t>(time.time_since_epoch().count());
+    return true;
+}
+
+bool TextureAtlas::load_or_bake(std::string const &cache_filename, std::vector<Source> const &sources) {
+    if (load_cache(cache_filename, sources)) return true;
+
+    for (auto const &source : sources) {
+        add_png(source.name, source.filename);
+    }
+    try {
+        save_cache(cache_filename, sources);
+    } catch (std::exception const &e) {
+        // not fatal, the atlas is just packed again next time
+        std::cerr << "WARNING: couldn't write atlas cache '" << cache_filename << "': " << e.what() << std::endl;
+    }
+    return false;
+}
+
+void TextureAtlas::save_cache(std::string const &filename, std::vector<Source> const &sources) const {
+    std::vector<char> strings;
+    auto add_string = [&strings](std::string const &str, uint32_t *begin, uint32_t *end) {
+        *begin = static_cast<uint32_t>(strings.size());
+        strings.insert(strings.end(), str.begin(), str.end());
+        *end = static_cast<uint32_t>(strings.size());
+    };
+
+    std::vector<CacheHeader> header(1);
+    header[0].version = CACHE_VERSION;
+    header[0].page_width = page_size.x;
+    header[0].page_height = page_size.y;
+    header[0].page_count = page_count;
+
+    std::vector<SourceEntry> source_entries;
+    for (auto const &source : sources) {
+        SourceEntry entry;
+        add_string(source.name, &entry.name_begin, &entry.name_end);
+        add_string(source.filename, &entry.filename_begin, &entry.filename_end);
+        if (!stamp_file(source.filename, &entry.size, &entry.mtime)) {
+            throw std::runtime_error("can't stat source '" + source.filename + "'");
+        }
+        source_entries.emplace_back(entry);
+    }
+
+    std::vector<SpriteEntry> sprite_entries;
+    for (auto const &named : sprites) {
+        SpriteEntry entry;
+        add_string(named.first, &entry.name_begin, &entry.name_end);
+        entry.uv_upper_left = named.second.uv_upper_left;
+        entry.uv_bottom_right = named.second.uv_bottom_right;
+        entry.layer = named.second.layer;
+        sprite_entries.emplace_back(entry);
+    }
+
+    // skylines are kept so that more sprites can be added after loading
+    std::vector<SegmentEntry> segment_entries;
+    for (uint32_t page = 0; page < skylines.size(); ++page) {
+        for (auto const &segment : skylines[page]) {
+            segment_entries.emplace_back(SegmentEntry{page, segment.x, segment.y, segment.width});
+        }
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("can't open file for writing");
+    }
+    write_chunk("atl0", header, &file);
+    write_chunk("str0", strings, &file);
+    write_chunk("src0", source_entries, &file);
+    write_chunk("spr0", sprite_entries, &file);
+    write_chunk("sky0", segment_entries, &file);
+    write_chunk("pix0", pixels, &file);
+    if (!file) {
+        throw std::runtime_error("write failed");
+    }
+}
+
+namespace {
+// read-only stream over bytes already in memory, so read_chunk can parse them without another copy
+struct MemoryStreamBuffer : std::streambuf {
+    MemoryStreamBuffer(char *begin, char *end) {
+        setg(begin, begin, end);
+    }
+};
+}
+
+bool TextureAtlas::load_cache(std::string const &filename, std::vector<Source> const &sources) {
+    // the whole file is brought in with a single read and parsed in place; each chunk is then
+    // copied once, from the file's bytes into its final vector
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file) return false;
+    std::vector<char> blob(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    if (!file.read(blob.data(), blob.size())) return false;
+    MemoryStreamBuffer buffer(blob.data(), blob.data() + blob.size());
+    std::istream from(&buffer);
+
+    std::vector<CacheHeader> header;
+    std::vector<char> strings;
+    std::vector<SourceEntry> source_entries;
+    std::vector<SpriteEntry> sprite_entries;
+    std::vector<SegmentEntry> segment_entries;
+    std::vector<glm::u8vec4> cached_pixels;
+    try {
+        read_chunk(from, "atl0", &header);
+        read_chunk(from, "str0", &strings);
+        read_chunk(from, "src0", &source_entries);
+        read_chunk(from, "spr0", &sprite_entries);
+        read_chunk(from, "sky0", &segment_entries);
+        read_chunk(from, "pix0", &cached_pixels);
+    } catch (std::exception const &e) {
+        // (a corrupt size field can also end in bad_alloc or length_error; any of these just means rebake)
+        std::cerr << "WARNING: ignoring broken atlas cache '" << filename << "': " << e.what() << std::endl;
+        return false;
+    }
+
+    auto get_string = [&strings](uint32_t begin, uint32_t end, std::string *out) {
+        if (!(begin <= end && end <= strings.size())) return false;
+        *out = std::string(strings.begin() + begin, strings.begin() + end);
+        return true;
+    };
+
+    // stale if anything about the sources or the page layout changed
+    if (header.size() != 1 || header[0].version != CACHE_VERSION) return false;
+    if (header[0].page_width != page_size.x || header[0].page_height != page_size.y) return false;
+    if (cached_pixels.size() != size_t(page_size.x) * page_size.y * header[0].page_count) return false;
+    if (source_entries.size() != sources.size()) return false;
+    for (size_t i = 0; i < sources.size(); ++i) {
+        SourceEntry const &entry = source_entries[i];
+        std::string name, source_filename;
+        uint64_t size, mtime;
+        if (!get_string(entry.name_begin, entry.name_end, &name) || name != sources[i].name) return false;
+        if (!get_string(entry.filename_begin, entry.filename_end, &source_filename) || source_filename != sources[i].filename) return false;
+        if (!stamp_file(sources[i].filename, &size, &mtime) || size != entry.size || mtime != entry.mtime) return false;
+    }
+
+    std::unordered_map<std::string, Sprite> cached_sprites;
+    for (auto const &entry : sprite_entries) {
+        std::string name;
+        if (!get_string(entry.name_begin, entry.name_end, &name) || entry.layer >= header[0].page_count) return false;
+        Sprite &sprite = cached_sprites[name];
+        sprite.uv_upper_left = entry.uv_upper_left;
+        sprite.uv_bottom_right = entry.uv_bottom_right;
+        sprite.layer = entry.layer;
+    }
+
+    std::vector<std::vector<Segment>> cached_skylines(header[0].page_count);
+    for (auto const &entry : segment_entries) {
+        if (entry.page >= cached_skylines.size()) return false;
+        cached_skylines[entry.page].emplace_back(Segment{entry.x, entry.y, entry.width});
+    }
+
+    page_count = header[0].page_count;
+    pixels = std::move(cached_pixels);
+    sprites = std::move(cached_sprites);
+    skylines = std::move(cached_skylines);
+    return true;
+}
+
+//-------------------------
+
+void TextureAtlas::upload() {
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, page_size.x, page_size.y, page_count, 0,
+        GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    GL_ERRORS();
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+/**
+ * @brief Pack many small images into one array texture
+ *
+ * Sprites are placed on pages (layers of a GL_TEXTURE_2D_ARRAY) by a skyline packer, and a new
+ * page is started when one fills up. Everything drawn from an atlas therefore needs a single
+ * texture binding; where a sprite ended up is found through its name in the uv table.
+ *
+ * Decoding and packing many PNGs is slow, so the packed atlas can be baked into a cache file
+ * (see load_or_bake) that is read back in one go as long as its source files are unchanged.
+ */
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "GL.hpp"
+
+
+class TextureAtlas {
+public:
+    // where a sprite lives in the atlas
+    struct Sprite {
+        glm::vec2 uv_upper_left;
+        glm::vec2 uv_bottom_right;
+        uint32_t layer = 0;
+    };
+
+    // the first page always starts with a white block at uv (0,0), so untextured squares stay plain
+    static constexpr const char *WHITE = "";
+
+    TextureAtlas(glm::uvec2 page_size = glm::uvec2(1024U));
+    TextureAtlas(const TextureAtlas&)=delete;
+    ~TextureAtlas();
+
+    // pack an image; throws if it is larger than a page
+    Sprite const &add(std::string const &name, glm::uvec2 size, std::vector<glm::u8vec4> const &data);
+
+    // load a png with load_png and pack it
+    Sprite const &add_png(std::string const &name, std::string const &filename);
+
+    // throws if no sprite has this name
+    Sprite const &lookup(std::string const &name) const;
+
+    // a png packed under a name
+    struct Source {
+        std::string name;
+        std::string filename;
+    };
+
+    // Fill a fresh atlas with the sources, from the cache file if it was baked from the same files
+    // (compared by size and modification time), otherwise by packing them and rewriting the cache.
+    // Returns true if the cache was used. upload() still has to be called afterwards.
+    bool load_or_bake(std::string const &cache_filename, std::vector<Source> const &sources);
+
+    // write the packed state along with stamps of the sources it was built from
+    void save_cache(std::string const &filename, std::vector<Source> const &sources) const;
+
+    // replace the packed state with a cache file's; false if it is missing, broken or stale
+    bool load_cache(std::string const &filename, std::vector<Source> const &sources);
+
+    // (re)create the array texture from the packed pages
+    void upload();
+
+    glm::uvec2 page_size;
+    uint32_t page_count = 0;
+    std::vector<glm::u8vec4> pixels;  // all pages back to back, rows from the top
+    std::unordered_map<std::string, Sprite> sprites;  // uv table
+
+    GLuint texture = 0;
+
+private:
+    // skyline of a page: the packed height over [x, x + width)
+    struct Segment {
+        uint32_t x, y, width;
+    };
+    std::vector<std::vector<Segment>> skylines;
+
+    // find room for a w x h rectangle on a page, returns false if it doesn't fit
+    bool place(std::vector<Segment> &skyline, glm::uvec2 size, glm::uvec2 *at) const;
+
+    void add_page();
+};
@@ -5,126 +5,410 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <cstddef>
+
 #include "gl_errors.hpp"
 
 
 TileDrawer::TileDrawer() {
-    glGenBuffers(RENDER_QUEUE_SIZE, vbos);
-    glGenVertexArrays(RENDER_QUEUE_SIZE, vaos);
+    glGenBuffers(1, &quad_vbo);
+    glGenBuffers(BATCH_COUNT, vbos);
+    glGenVertexArrays(BATCH_COUNT * STREAM_FRAMES, &vaos[0][0]);
+    glGenBuffers(1, &camera_ubo);
 
     program = gl_compile_program(
         "#version 330 core\n"
-        "layout(location = 0) in vec2 position;\n"
-        "layout(location = 1) in vec2 tex_coord;\n"
+        "layout(location = 0) in vec2 corner;\n"
+        "layout(location = 1) in vec2 position;\n"
+        "layout(location = 2) in vec2 size;\n"
+        "layout(location = 3) in vec4 uv_rect;\n"
+        "layout(location = 4) in vec4 color;\n"
+        "layout(location = 5) in uint layer;\n"
+        "layout(location = 6) in float depth;\n"
         "\n"
         "out vec2 TexCoord;\n"
+        "out vec4 Color;\n"
+        "flat out uint Layer;\n"
         "\n"
-        "uniform mat4 PROJECTION;\n"
+        "layout(std140) uniform Camera {\n"
+        "  mat4 PROJECTION;\n"
+        "};\n"
         "\n"
         "void main() {\n"
-        "  TexCoord = tex_coord;\n"
-        "  gl_Position = PROJECTION * vec4(position, 0.0, 1.0);\n"
+        "  TexCoord = mix(uv_rect.xy, uv_rect.zw, corner);\n"
+        "  Color = color;\n"
+        "  Layer = layer;\n"
+        "  gl_Position = PROJECTION * vec4(position + (corner - 0.5) * size, depth, 1.0);\n"
         "}\n"
         ,
         "#version 330 core\n"
         "in vec2 TexCoord;\n"
+        "in vec4 Color;\n"
+        "flat in uint Layer;\n"
         "out vec4 color;\n"
         "\n"
-        "uniform sampler2D TEX;\n"
-        "uniform vec3 COLOR;\n"
+        "uniform sampler2DArray TEX;\n"
         "\n"
         "void main() {\n"
-        "  color = vec4(COLOR, 1.0);\n"
+        "  color = Color * texture(TEX, vec3(TexCoord, float(Layer)));\n"
+        "  if (color.a == 0.0) discard;\n"  // keep clear texels out of the depth buffer
         "}\n"
     );
 
+    // unit quad as a triangle strip, corners in [0,1]^2 with (0,0) at the upper left
+    const glm::vec2 quad[4] = {
+        glm::vec2(0.f, 0.f), glm::vec2(0.f, 1.f), glm::vec2(1.f, 0.f), glm::vec2(1.f, 1.f)
+    };
+    glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+
     // init VAOs
-    for (size_t queue = 0; queue < RENDER_QUEUE_SIZE; ++queue) {
-        glBindBuffer(GL_ARRAY_BUFFER, vbos[queue]);
-        glBindVertexArray(vaos[queue]);
-        glVertexAttribPointer(POSITION, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (GLvoid *)0);
-        glEnableVertexAttribArray(POSITION);
-        glVertexAttribPointer(TEXCOORD, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (GLvoid *)(2 * sizeof(GLfloat)));
-        glEnableVertexAttribArray(TEXCOORD);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindVertexArray(0);
+    for (size_t batch = 0; batch < BATCH_COUNT; ++batch) {
+        for (size_t r = 0; r < STREAM_FRAMES; ++r) {
+            glBindVertexArray(vaos[batch][r]);
+
+            glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
+            glVertexAttribPointer(CORNER, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (GLvoid *)0);
+            glEnableVertexAttribArray(CORNER);
+
+            for (GLuint loc : {POSITION, SIZE, UV_RECT, COLOR, LAYER, DEPTH}) {
+                glEnableVertexAttribArray(loc);
+                glVertexAttribDivisor(loc, 1);
+            }
+            point_instances(vaos[batch][r], vbos[batch], 0);
+        }
     }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    // plain white until an atlas is set, so untextured squares show their color
+    const glm::u8vec4 white(0xff);
+    glGenTextures(1, &white_texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, white_texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, 1, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &white);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    texture = white_texture;
 
-    // init uniform locations
-    PROJECTION_LOC = glGetUniformLocation(program, "PROJECTION");
-    TEX_LOC = glGetUniformLocation(program, "TEX");
-    COLOR_LOC = glGetUniformLocation(program, "COLOR");
+    // the projection lives in a uniform buffer, so it is only sent when the camera moves
+    glBindBuffer(GL_UNIFORM_BUFFER, camera_ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Camera"), CAMERA_BINDING);
+
+    // the array texture always sits on unit 0
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "TEX"), 0);
+    glUseProgram(0);
 }
 
 TileDrawer::~TileDrawer() {
-    glDeleteBuffers(RENDER_QUEUE_SIZE, vbos);
-    glDeleteVertexArrays(RENDER_QUEUE_SIZE, vaos);
+    glDeleteBuffers(1, &quad_vbo);
+    glDeleteBuffers(BATCH_COUNT, vbos);
+    glDeleteVertexArrays(BATCH_COUNT * STREAM_FRAMES, &vaos[0][0]);
+    glDeleteBuffers(1, &camera_ubo);
+    for (GLsync &fence : fences) {
+        if (fence) glDeleteSync(fence);
+    }
+    glDeleteTextures(1, &white_texture);
     glDeleteProgram(program);
     program = 0;
 }
 
+TileDrawer::Square TileDrawer::make_square(glm::vec2 position, glm::vec2 size, TextureAtlas::Sprite const &sprite) {
+    Square square{position, size, sprite.uv_upper_left, sprite.uv_bottom_right};
+    square.layer = sprite.layer;
+    return square;
+}
+
+void TileDrawer::point_instances(GLuint vao, GLuint vbo, size_t first) {
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    GLbyte *base = (GLbyte *)0 + first * sizeof(Square);
+    glVertexAttribPointer(POSITION, 2, GL_FLOAT, GL_FALSE, sizeof(Square), base + offsetof(Square, position));
+    glVertexAttribPointer(SIZE, 2, GL_FLOAT, GL_FALSE, sizeof(Square), base + offsetof(Square, size));
+    // uv_upper_left and uv_bottom_right are adjacent, so they are read as one vec4
+    glVertexAttribPointer(UV_RECT, 4, GL_FLOAT, GL_FALSE, sizeof(Square), base + offsetof(Square, uv_upper_left));
+    glVertexAttribPointer(COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Square), base + offsetof(Square, color));
+    glVertexAttribIPointer(LAYER, 1, GL_UNSIGNED_INT, sizeof(Square), base + offsetof(Square, layer));
+    glVertexAttribPointer(DEPTH, 1, GL_FLOAT, GL_FALSE, sizeof(Square), base + offsetof(Square, depth));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+// block until the GPU is done with whatever was drawn before the fence, then drop it
+static void wait_fence(GLsync &fence) {
+    if (!fence) return;
+    // with STREAM_FRAMES frames in between this has normally signaled long ago
+    GLenum result;
+    do {
+        result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000U);  // 1ms
+    } while (result == GL_TIMEOUT_EXPIRED);
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+void TileDrawer::DirtyRange::add(size_t first, size_t last) {
+    if (empty()) {
+        begin = first;
+        end = last;
+    } else {
+        begin = std::min(begin, first);
+        end = std::max(end, last);
+    }
+}
+
 size_t TileDrawer::add_component(const Square &&square, RenderQueues queue) {
     components[queue].emplace_back(square);
+    relayout[queue] = true;
+    mark_dirty(queue, components[queue].size() - 1, components[queue].size());
     return components[queue].size() - 1;
 }
 
 void TileDrawer::clear_components(RenderQueues queue) {
     components[queue].clear();
+    dirty[queue] = DirtyRange();
+    relayout[queue] = true;
+}
+
+TileDrawer::Square &TileDrawer::edit_component(size_t index, RenderQueues queue) {
+    mark_dirty(queue, index, index + 1);
+    return components[queue][index];
+}
+
+void TileDrawer::mark_dirty(RenderQueues queue, size_t begin, size_t end) {
+    dirty[queue].add(begin, end);
+}
+
+void TileDrawer::layout_chunks() {
+    struct Entry {
+        glm::ivec2 key;  // chunk coordinates
+        RenderQueues queue;
+        size_t index;
+    };
+    std::vector<Entry> entries;
+    for (RenderQueues queue : {BACKGROUND, MAP}) {
+        std::vector<Square> const &squares = components[queue];
+        slots[queue].resize(squares.size());
+        for (size_t i = 0; i < squares.size(); ++i) {
+            entries.emplace_back(Entry{glm::ivec2(glm::floor(squares[i].position / CHUNK_SIZE)), queue, i});
+        }
+        relayout[queue] = false;
+        dirty[queue] = DirtyRange();
+    }
+    // row major chunk order, so visible chunks of a row end up next to each other; inside a chunk lower
+    // queues come first, so translucent edges still blend over whatever lies beneath them; the sort is
+    // stable, so squares of one queue in one chunk keep their insertion (and overlap) order
+    std::stable_sort(entries.begin(), entries.end(), [](Entry const &a, Entry const &b) {
+        if (a.key.y != b.key.y) return a.key.y < b.key.y;
+        if (a.key.x != b.key.x) return a.key.x < b.key.x;
+        return a.queue < b.queue;
+    });
+
+    sorted.resize(entries.size());
+    chunks.clear();
+    for (size_t slot = 0; slot < entries.size(); ++slot) {
+        Entry const &entry = entries[slot];
+        Square &square = sorted[slot];
+        square = components[entry.queue][entry.index];
+        square.depth = static_cast<float>(entry.queue);
+        slots[entry.queue][entry.index] = slot;
+        if (chunks.empty() || chunks.back().key != entry.key) {
+            Chunk chunk;
+            chunk.key = entry.key;
+            chunk.first = slot;
+            chunk.min = square.position;
+            chunk.max = square.position;
+            chunks.emplace_back(chunk);
+        }
+        Chunk &chunk = chunks.back();
+        chunk.count += 1;
+        chunk.min = glm::min(chunk.min, square.position - square.size / 2.f);
+        chunk.max = glm::max(chunk.max, square.position + square.size / 2.f);
+    }
 }
 
 void TileDrawer::update_vertices(RenderQueues queue) {
-    vertices[queue].clear();
-
-    for (auto& square : components[queue]) {
-        glm::vec2 upper_left = square.position - square.size / 2.f;
-        glm::vec2 bottom_right = square.position + square.size / 2.f;
-        // add 6 vertices
-        // can be optimized
-        vertices[queue].emplace_back(
-            upper_left.x, upper_left.y, square.uv_upper_left.x, square.uv_upper_left.y
-        );
-        vertices[queue].emplace_back(
-            upper_left.x, bottom_right.y, square.uv_upper_left.x, square.uv_bottom_right.y
-        );
-        vertices[queue].emplace_back(
-            bottom_right.x, bottom_right.y, square.uv_bottom_right.x, square.uv_bottom_right.y
-        );
-        vertices[queue].emplace_back(
-            upper_left.x, upper_left.y, square.uv_upper_left.x, square.uv_upper_left.y
-        );
-        vertices[queue].emplace_back(
-            bottom_right.x, bottom_right.y, square.uv_bottom_right.x, square.uv_bottom_right.y
-        );
-        vertices[queue].emplace_back(
-            bottom_right.x, upper_left.y, square.uv_bottom_right.x, square.uv_upper_left.y
-        );
+    if (batch_of(queue) == STREAMED_BATCH) {
+        // the streamed queues share their ring regions, so both are written at once by the next draw
+        stream_pending = stream_pending || relayout[queue] || !dirty[queue].empty();
+        relayout[queue] = false;
+        dirty[queue] = DirtyRange();
+        return;
+    }
+
+    // squares are drawn as instances of the unit quad, so they are uploaded without expansion
+    glBindBuffer(GL_ARRAY_BUFFER, vbos[STATIC_BATCH]);
+    if (relayout[BACKGROUND] || relayout[MAP]) {
+        layout_chunks();
+        instance_counts[STATIC_BATCH] = static_cast<GLsizei>(sorted.size());
+        if (sorted.size() > capacities[STATIC_BATCH]) {
+            // grow storage geometrically, so adding tiles in batches stays cheap
+            capacities[STATIC_BATCH] = std::max(sorted.size(), std::max<size_t>(2 * capacities[STATIC_BATCH], 64U));
+            glBufferData(GL_ARRAY_BUFFER, capacities[STATIC_BATCH] * sizeof(Square), nullptr, GL_STATIC_DRAW);
+        }
+        if (!sorted.empty()) {
+            glBufferSubData(GL_ARRAY_BUFFER, 0, sorted.size() * sizeof(Square), sorted.data());
+        }
+    } else if (!dirty[queue].empty()) {
+        // only the slots of changed components are sent; a moved square widens its chunk's bounds
+        std::vector<Square> const &squares = components[queue];
+        size_t end = std::min(dirty[queue].end, squares.size());
+        size_t slot_begin = sorted.size(), slot_end = 0;
+        for (size_t index = dirty[queue].begin; index < end; ++index) {
+            size_t slot = slots[queue][index];
+            Square const &square = squares[index];
+            sorted[slot] = square;
+            sorted[slot].depth = static_cast<float>(queue);
+            auto chunk = std::upper_bound(chunks.begin(), chunks.end(), slot,
+                [](size_t s, Chunk const &c) { return s < c.first; }) - 1;
+            chunk->min = glm::min(chunk->min, square.position - square.size / 2.f);
+            chunk->max = glm::max(chunk->max, square.position + square.size / 2.f);
+            slot_begin = std::min(slot_begin, slot);
+            slot_end = std::max(slot_end, slot + 1);
+        }
+        if (slot_begin < slot_end) {
+            glBufferSubData(GL_ARRAY_BUFFER, slot_begin * sizeof(Square),
+                (slot_end - slot_begin) * sizeof(Square), sorted.data() + slot_begin);
+        }
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    dirty[queue] = DirtyRange();
+}
+
+void TileDrawer::stream() {
+    size_t count = components[CHARACTER].size() + components[FOREGROUND].size();
+    instance_counts[STREAMED_BATCH] = static_cast<GLsizei>(count);
+
+    glBindBuffer(GL_ARRAY_BUFFER, vbos[STREAMED_BATCH]);
+    if (count > capacities[STREAMED_BATCH]) {
+        // reallocating orphans the old storage, so pending fences don't matter anymore
+        size_t &capacity = capacities[STREAMED_BATCH];
+        capacity = std::max(count, std::max<size_t>(2 * capacity, 64U));
+        glBufferData(GL_ARRAY_BUFFER, STREAM_FRAMES * capacity * sizeof(Square), nullptr, GL_STREAM_DRAW);
+        for (size_t r = 0; r < STREAM_FRAMES; ++r) {
+            if (fences[r]) {
+                glDeleteSync(fences[r]);
+                fences[r] = nullptr;
+            }
+            point_instances(vaos[STREAMED_BATCH][r], vbos[STREAMED_BATCH], r * capacity);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[STREAMED_BATCH]);
     }
 
-    // update vbo
-    glBindBuffer(GL_ARRAY_BUFFER, vbos[queue]);
-    const GLenum drawtypes[RENDER_QUEUE_SIZE] = {GL_STATIC_DRAW, GL_STATIC_DRAW, GL_STREAM_DRAW, GL_STREAM_DRAW};
-    glBufferData(GL_ARRAY_BUFFER, vertices[queue].size() * sizeof(glm::vec4), vertices[queue].data(), drawtypes[queue]);
+    // write both queues into the next region, which the GPU has finished reading
+    region = (region + 1) % STREAM_FRAMES;
+    wait_fence(fences[region]);
+    if (count != 0) {
+        GLintptr offset = region * capacities[STREAMED_BATCH] * sizeof(Square);
+        GLsizeiptr length = count * sizeof(Square);
+        Square *dst = static_cast<Square *>(glMapBufferRange(GL_ARRAY_BUFFER, offset, length,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+        std::vector<Square> fallback;
+        if (!dst) {
+            fallback.resize(count);
+            dst = fallback.data();
+        }
+        for (RenderQueues queue : {CHARACTER, FOREGROUND}) {
+            for (Square const &square : components[queue]) {
+                *dst = square;
+                dst->depth = static_cast<float>(queue);
+                ++dst;
+            }
+        }
+        if (fallback.empty()) {
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        } else {
+            glBufferSubData(GL_ARRAY_BUFFER, offset, length, fallback.data());
+        }
+    }
     glBindBuffer(GL_ARRAY_BUFFER, 0);
+    stream_pending = false;
 }
 
 void TileDrawer::update_drawable_size(glm::uvec2 _drawable_size) {
     drawable_size = _drawable_size;
-    projection = glm::ortho(0.f, static_cast<float>(drawable_size.x), static_cast<float>(drawable_size.y), 0.f, -10.f, 10.f);
+    set_camera(camera);
+}
+
+void TileDrawer::set_camera(glm::vec2 upper_left) {
+    camera = upper_left;
+    glm::vec2 lower_right = camera + glm::vec2(drawable_size);
+    // queues sit at depth 0 to RENDER_QUEUE_SIZE - 1, higher ones nearer to the viewer
+    glm::mat4 view = glm::ortho(camera.x, lower_right.x, lower_right.y, camera.y, -10.f, 10.f);
+    if (view == projection) return;
+    projection = view;
+    glBindBuffer(GL_UNIFORM_BUFFER, camera_ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), glm::value_ptr(projection));
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void TileDrawer::set_atlas(TextureAtlas const &atlas) {
+    texture = atlas.texture;
 }
 
 void TileDrawer::draw() {
+    if (stream_pending) stream();
+
     glUseProgram(program);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    // queues are told apart by depth; within one, the later square still wins like painting did
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LEQUAL);
+    glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BINDING, camera_ubo);
+
+    // every queue samples the same array texture, so it is bound once
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
 
-    for (size_t queue = 0; queue < RENDER_QUEUE_SIZE; ++queue) {
-        if (vertices[queue].empty()) {
-            continue;
+    glm::vec2 view_min = camera;
+    glm::vec2 view_max = camera + glm::vec2(drawable_size);
+
+    // Draw the visible chunks, merging neighbours into one instanced draw. (glMultiDrawArrays can't
+    // select instance ranges, so each range re-points the instance attributes instead.)
+    GLuint static_vao = vaos[STATIC_BATCH][0];
+    size_t first = 0, count = 0;
+    auto flush = [&]() {
+        if (count == 0) return;
+        point_instances(static_vao, vbos[STATIC_BATCH], first);
+        glBindVertexArray(static_vao);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(count));
+        glBindVertexArray(0);
+        count = 0;
+    };
+    for (Chunk const &chunk : chunks) {
+        bool visible = chunk.max.x >= view_min.x && chunk.min.x <= view_max.x
+            && chunk.max.y >= view_min.y && chunk.min.y <= view_max.y;
+        if (!visible) {
+            flush();
+        } else if (count != 0 && first + count == chunk.first) {
+            count += chunk.count;
+        } else {
+            flush();
+            first = chunk.first;
+            count = chunk.count;
         }
-        glUniformMatrix4fv(PROJECTION_LOC, 1, GL_FALSE, glm::value_ptr(projection));
-        glUniform3f(COLOR_LOC, 1.f, 1.f, 1.f);
-        glBindVertexArray(vaos[queue]);
-        glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(vertices[queue].size()));
+    }
+    flush();
+
+    if (instance_counts[STREAMED_BATCH] != 0) {
+        glBindVertexArray(vaos[STREAMED_BATCH][region]);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instance_counts[STREAMED_BATCH]);
         glBindVertexArray(0);
+        // the region may be rewritten once this draw is done
+        if (fences[region]) glDeleteSync(fences[region]);
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
     }
+
+    // leave blending and depth as they were before tiles were drawn (GL defaults)
+    glDepthFunc(GL_LESS);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BINDING, 0);
     glUseProgram(0);
 	GL_ERRORS();
 }
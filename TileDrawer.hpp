@@ -3,6 +3,7 @@
 #include <vector>
 #include <glm/glm.hpp>
 #include "GL.hpp"
+#include "TextureAtlas.hpp"
 
 
 class TileDrawer {
@@ -17,29 +18,89 @@ public:
     };
     
     enum ATTR_LOCS : GLuint {
-        POSITION = 0U,
-        TEXCOORD = 1U,
+        CORNER = 0U,  // per vertex: corner of the unit quad
+        POSITION = 1U,  // per instance from here on
+        SIZE = 2U,
+        UV_RECT = 3U,
+        COLOR = 4U,
+        LAYER = 5U,
+        DEPTH = 6U,
     };
 
     // a square with tex coord
+    // also the per-instance vertex data, uploaded as is
     struct Square {
         glm::vec2 position;
         glm::vec2 size; // width, height
         glm::vec2 uv_upper_left;
         glm::vec2 uv_bottom_right;
+        glm::u8vec4 color = glm::u8vec4(0xff);
+        uint32_t layer = 0;  // atlas page the uvs refer to
+        float depth = 0.f;  // overwritten with the render queue on upload
     };
 
+    // a square showing an atlas sprite
+    static Square make_square(glm::vec2 position, glm::vec2 size, TextureAtlas::Sprite const &sprite);
+
+    // range of components changed since the last upload, [begin, end)
+    struct DirtyRange {
+        size_t begin = 0;
+        size_t end = 0;
+        bool empty() const { return begin >= end; }
+        void add(size_t first, size_t last);
+    };
+
+    // The queues are merged into two batches, each drawn in one depth tested pass: squares get their
+    // queue as depth, so later queues cover earlier ones no matter in which order they are drawn.
+    // Squares of the same queue tie on depth (GL_LEQUAL), so the one drawn later wins: in the streamed
+    // batch that is insertion order; in the static batch it is insertion order only inside a chunk, and
+    // overlapping squares of one queue in different chunks are drawn in chunk order instead.
+    enum Batches : size_t {
+        STATIC_BATCH = 0U,  // BACKGROUND and MAP
+        STREAMED_BATCH,  // CHARACTER and FOREGROUND
+        BATCH_COUNT
+    };
+    static Batches batch_of(size_t queue) { return queue >= CHARACTER ? STREAMED_BATCH : STATIC_BATCH; }
+
+    // The streamed batch is rewritten whenever one of its queues changes. Its vbo is a ring of
+    // STREAM_FRAMES regions written through unsynchronized maps; a region is reused only after the
+    // fence put behind its last draw.
+    static constexpr size_t STREAM_FRAMES = 3;
+
+    // The static batch is stored on the GPU sorted into chunks, fixed-size world regions, so only the
+    // chunks overlapping the camera get drawn.
+    static constexpr float CHUNK_SIZE = 512.f;
+    struct Chunk {
+        glm::ivec2 key;  // chunk coordinates, position / CHUNK_SIZE
+        size_t first = 0;  // first instance slot
+        size_t count = 0;
+        glm::vec2 min, max;  // bounds of the squares in it
+    };
+
+    // uniform block binding point of the shared camera block
+    static constexpr GLuint CAMERA_BINDING = 0;
+
     std::vector<Square> components[RENDER_QUEUE_SIZE];
-    std::vector<glm::vec4> vertices[RENDER_QUEUE_SIZE];
-    GLuint vbos[RENDER_QUEUE_SIZE];
-    GLuint vaos[RENDER_QUEUE_SIZE];
+    DirtyRange dirty[RENDER_QUEUE_SIZE];
+    bool relayout[RENDER_QUEUE_SIZE] = {};  // components were added or removed
+    std::vector<size_t> slots[RENDER_QUEUE_SIZE];  // component index -> instance slot in the static batch
+    std::vector<Chunk> chunks;  // of the static batch
+    std::vector<Square> sorted;  // static batch instances in slot order
+    bool stream_pending = false;  // the streamed batch needs rewriting before the next draw
+    size_t capacities[BATCH_COUNT] = {};  // instances the vbo (or each ring region) has storage for
+    GLsizei instance_counts[BATCH_COUNT] = {};
+    GLuint quad_vbo = 0;  // static unit quad shared by both batches
+    GLuint vbos[BATCH_COUNT];  // per-instance data
+    GLuint vaos[BATCH_COUNT][STREAM_FRAMES];  // one per ring region, the static batch only uses [0]
+    size_t region = 0;  // ring region of the streamed batch written last
+    GLsync fences[STREAM_FRAMES] = {};
+    GLuint camera_ubo = 0;  // std140 block holding the projection
     GLuint program;
+    GLuint white_texture = 0;  // 1x1 array texture used until an atlas is set
+    GLuint texture = 0;  // GL_TEXTURE_2D_ARRAY sampled by every queue
 
-    GLuint PROJECTION_LOC = -1U;
-    GLuint TEX_LOC = -1U;
-    GLuint COLOR_LOC = -1U;
-
-    glm::mat4 projection;
+    glm::mat4 projection = glm::mat4(0.f);
+    glm::vec2 camera = glm::vec2(0.f);  // world position shown at the upper left of the screen
 
     TileDrawer();
     ~TileDrawer();
@@ -48,11 +109,34 @@ public:
 
     void clear_components(RenderQueues);
 
+    // access a component for modification, it will be re-uploaded by the next update_vertices
+    Square &edit_component(size_t index, RenderQueues queue);
+
+    // components written directly through `components` need to be marked by hand
+    void mark_dirty(RenderQueues queue, size_t begin, size_t end);
+
+    // push the changed components of a queue to the GPU (streamed queues are written by the next draw)
+    // adding or removing components re-sorts the static batch, so do it once after a batch of adds
     void update_vertices(RenderQueues queue);
 
     void update_drawable_size(glm::uvec2 drawable_size);
 
+    void set_camera(glm::vec2 upper_left);
+
+    // draw all queues from this atlas' texture; it has to outlive the drawer or be replaced
+    void set_atlas(TextureAtlas const &atlas);
+
     void draw();
 
     glm::uvec2 drawable_size;
+
+private:
+    // point the per-instance attributes of a vao at the instances starting from `first`
+    void point_instances(GLuint vao, GLuint vbo, size_t first);
+
+    // sort the static queues into chunks, filling sorted, slots and chunks
+    void layout_chunks();
+
+    // write the streamed queues into the next ring region
+    void stream();
 };
@@ -506,6 +506,34 @@ for char_glyph in sorted(glyphs.items()):
 	for pair in glyph_lines:
 		out_coords += list(pair)
 
+#glyph lookup trie: one node per prefix of a glyph name (as utf8 bytes),
+# the first byte of a name is looked up directly in a 256-entry root table:
+NONE = 0xffffffff
+prefixes = set()
+for name in [ bytes(out_chars[out_glyph_char_starts[i]:(out_glyph_char_starts+[len(out_chars)])[i+1]]) for i in range(out_glyphs) ]:
+	for l in range(1, len(name)+1):
+		prefixes.add(name[0:l])
+prefixes = sorted(prefixes, key=lambda p: (len(p), p))
+node_of = dict()
+for p in prefixes:
+	node_of[p] = len(node_of)
+
+out_trie_root = [ node_of.get(bytes([b]), NONE) for b in range(0,256) ]
+out_trie_node_glyphs = [ NONE ] * len(prefixes)
+for i in range(out_glyphs):
+	name = bytes(out_chars[out_glyph_char_starts[i]:(out_glyph_char_starts+[len(out_chars)])[i+1]])
+	out_trie_node_glyphs[node_of[name]] = i
+out_trie_node_edge_starts = []
+out_trie_edge_bytes = []
+out_trie_edge_nodes = []
+for p in prefixes:
+	out_trie_node_edge_starts += [len(out_trie_edge_bytes)]
+	for q in prefixes:
+		if len(q) == len(p) + 1 and q[0:len(p)] == p:
+			out_trie_edge_bytes += [q[-1]]
+			out_trie_edge_nodes += [node_of[q]]
+out_trie_node_edge_starts += [len(out_trie_edge_bytes)]
+
 print("Font covers: " + ", ".join(map(lambda x: "'" + x + "'", sorted(glyphs.keys()))))
 missing = []
 for m in range(0x20, 0x7f):
@@ -521,6 +549,7 @@ def w(s):
 	cppfile.write(s.encode('utf8'))
 
 def wd(d,fs, wrap):
+	if len(d) == 0: d = [0] #C++ has no empty arrays; the entry is never read
 	w('\t\t')
 	for i in range(0,len(d)):
 		if i != 0: w(',')
@@ -553,8 +582,33 @@ w('\tconstexpr const float font_coords[' + str(len(out_coords)) + '] = {\n')
 wd(out_coords, "{:.6f}f", 6)
 w('\t};\n')
 
+def index(i):
+	if i == NONE: return '-1U'
+	else: return str(i)
+
+w('\tconstexpr const uint32_t font_trie_root[256] = {\n')
+wd(list(map(index, out_trie_root)), "{}", 16)
+w('\t};\n')
+
+w('\tconstexpr const uint32_t font_trie_node_glyphs[' + str(len(out_trie_node_glyphs)) + '] = {\n')
+wd(list(map(index, out_trie_node_glyphs)), "{}", 12)
+w('\t};\n')
+
+w('\tconstexpr const uint32_t font_trie_node_edge_starts[' + str(len(out_trie_node_edge_starts)) + '] = {\n')
+wd(out_trie_node_edge_starts, "{}", 12)
+w('\t};\n')
+
+w('\tconstexpr const uint8_t font_trie_edge_bytes[' + str(max(1, len(out_trie_edge_bytes))) + '] = {\n')
+wd(out_trie_edge_bytes, "{}", 12)
+w('\t};\n')
+
+w('\tconstexpr const uint32_t font_trie_edge_nodes[' + str(max(1, len(out_trie_edge_nodes))) + '] = {\n')
+wd(out_trie_edge_nodes, "{}", 12)
+w('\t};\n')
+
 
 w('}\n')
-w('PathFont PathFont::font(font_glyphs, font_glyph_widths, font_glyph_char_starts, font_chars, font_glyph_coord_starts, font_coords);\n')
+w('PathFont PathFont::font(font_glyphs, font_glyph_widths, font_glyph_char_starts, font_chars, font_glyph_coord_starts, font_coords,\n')
+w('\tfont_trie_root, font_trie_node_glyphs, font_trie_node_edge_starts, font_trie_edge_bytes, font_trie_edge_nodes);\n')
 
 cppfile.close()
@@ -4,6 +4,8 @@
 #Patched for 15-466-f19 to remove non-pnct formats!
 #Patched for 15-466-f20 to merge data all at once (slightly faster)
 
+#Patched to also write decimated levels of detail (see LOD_RATIOS below)
+
 #Note: Script meant to be executed within blender 2.9, as per:
 #blender --background --python export-meshes.py -- [...see below...]
 
@@ -39,6 +41,14 @@ print(" of '" + infile + "' to '" + outfile + "'.")
 
 import struct
 
+#levels of detail: meshes with at least LOD_MIN_TRIANGLES triangles also get decimated copies
+# with these fractions of the original triangle count. Each level is written as another index
+# entry with the same name, finest first (MeshBuffer treats repeated names as coarser levels);
+# levels that don't cut the previous level's triangles to at most LOD_MAX_KEEP are skipped:
+LOD_RATIOS = [0.5, 0.25, 0.125]
+LOD_MIN_TRIANGLES = 256
+LOD_MAX_KEEP = 0.75
+
 bpy.ops.wm.open_mainfile(filepath=infile)
 
 if collection_name:
@@ -134,62 +144,89 @@ for obj in bpy.data.objects:
 	mesh.calc_normals_split()
 
 	#record mesh name, start position and vertex count in the index:
+	# (called once per level of detail, with the triangulated or decimated mesh data)
+	def write_level(mesh):
+		global vertex_count, index
+		index += struct.pack('I', name_begin)
+		index += struct.pack('I', name_end)
+
+		index += struct.pack('I', vertex_count) #vertex_begin
+		#...count will be written below
+
+		colors = None
+		if len(mesh.vertex_colors) != 0:
+			colors = mesh.vertex_colors.active.data
+
+		uvs = None
+		if len(mesh.uv_layers) != 0:
+			uvs = mesh.uv_layers.active.data
+
+		local_data = b''
+
+		#write the mesh triangles:
+		for poly in mesh.polygons:
+			assert(len(poly.loop_indices) == 3)
+			for i in range(0,3):
+				assert(mesh.loops[poly.loop_indices[i]].vertex_index == poly.vertices[i])
+				loop = mesh.loops[poly.loop_indices[i]]
+				vertex = mesh.vertices[loop.vertex_index]
+				for x in vertex.co:
+					local_data += struct.pack('f', x)
+				for x in loop.normal:
+					local_data += struct.pack('f', x)
+				if colors != None:
+					col = colors[poly.loop_indices[i]].color
+					local_data += struct.pack('BBBB', int(col[0] * 255), int(col[1] * 255), int(col[2] * 255), 255)
+				else:
+					local_data += struct.pack('BBBB', 255, 255, 255, 255)
+				if uvs != None:
+					uv = uvs[poly.loop_indices[i]].uv
+					local_data += struct.pack('ff', uv.x, uv.y)
+				else:
+					local_data += struct.pack('ff', 0, 0)
+			if len(local_data) > 1000:
+				data.append(local_data)
+				local_data = b''
+		vertex_count += len(mesh.polygons) * 3
+
+		data.append(local_data)
+
+		index += struct.pack('I', vertex_count) #vertex_end
+
 	name_begin = len(strings)
 	strings += bytes(name, "utf8")
 	name_end = len(strings)
-	index += struct.pack('I', name_begin)
-	index += struct.pack('I', name_end)
 
-	index += struct.pack('I', vertex_count) #vertex_begin
-	#...count will be written below
-
-	colors = None
 	if len(obj.data.vertex_colors) == 0:
 		print("WARNING: trying to export color data, but object '" + name + "' does not have color data; will output 0xffffffff")
-	else:
-		colors = obj.data.vertex_colors.active.data
-		if len(obj.data.vertex_colors) != 1:
-			print("WARNING: object '" + name + "' has multiple vertex color layers; only exporting '" + obj.data.vertex_colors.active.name + "'")
+	elif len(obj.data.vertex_colors) != 1:
+		print("WARNING: object '" + name + "' has multiple vertex color layers; only exporting '" + obj.data.vertex_colors.active.name + "'")
 
-	uvs = None
 	if len(obj.data.uv_layers) == 0:
 		print("WARNING: trying to export texcoord data, but object '" + name + "' does not uv data; will output (0.0, 0.0)")
-	else:
-		uvs = obj.data.uv_layers.active.data
-		if len(obj.data.uv_layers) != 1:
-			print("WARNING: object '" + name + "' has multiple texture coordinate layers; only exporting '" + obj.data.uv_layers.active.name + "'")
-
-	local_data = b''
-
-	#write the mesh triangles:
-	for poly in mesh.polygons:
-		assert(len(poly.loop_indices) == 3)
-		for i in range(0,3):
-			assert(mesh.loops[poly.loop_indices[i]].vertex_index == poly.vertices[i])
-			loop = mesh.loops[poly.loop_indices[i]]
-			vertex = mesh.vertices[loop.vertex_index]
-			for x in vertex.co:
-				local_data += struct.pack('f', x)
-			for x in loop.normal:
-				local_data += struct.pack('f', x)
-			if colors != None:
-				col = colors[poly.loop_indices[i]].color
-				local_data += struct.pack('BBBB', int(col[0] * 255), int(col[1] * 255), int(col[2] * 255), 255)
-			else:
-				local_data += struct.pack('BBBB', 255, 255, 255, 255)
-			if uvs != None:
-				uv = uvs[poly.loop_indices[i]].uv
-				local_data += struct.pack('ff', uv.x, uv.y)
-			else:
-				local_data += struct.pack('ff', 0, 0)
-		if len(local_data) > 1000:
-			data.append(local_data)
-			local_data = b''
-	vertex_count += len(mesh.polygons) * 3
-
-	data.append(local_data)
-
-	index += struct.pack('I', vertex_count) #vertex_end
+	elif len(obj.data.uv_layers) != 1:
+		print("WARNING: object '" + name + "' has multiple texture coordinate layers; only exporting '" + obj.data.uv_layers.active.name + "'")
+
+	write_level(mesh)
+
+	#write decimated levels of detail:
+	triangles = len(mesh.polygons)
+	if triangles >= LOD_MIN_TRIANGLES:
+		for ratio in LOD_RATIOS:
+			decimate = obj.modifiers.new(name="LOD", type='DECIMATE')
+			decimate.decimate_type = 'COLLAPSE'
+			decimate.ratio = ratio
+			decimate.use_collapse_triangulate = True
+
+			evaluated = obj.evaluated_get(bpy.context.evaluated_depsgraph_get())
+			lod = evaluated.to_mesh()
+			lod.calc_normals_split()
+			if len(lod.polygons) <= LOD_MAX_KEEP * triangles:
+				print("  level of detail with " + str(len(lod.polygons)) + " of " + str(len(mesh.polygons)) + " triangles")
+				write_level(lod)
+				triangles = len(lod.polygons)
+			evaluated.to_mesh_clear()
+			obj.modifiers.remove(decimate)
 
 data = b''.join(data)
 
@@ -97,6 +97,11 @@ int main(int argc, char **argv) {
 		try {
 			buffer = new MeshBuffer(meshes_file);
 			buffer_vao = buffer->make_vao_for_program(show_scene_program->program);
+			for (auto const &m : buffer->meshes) {
+				if (m.second.lods.size() > Scene::Drawable::LODCount) {
+					std::cerr << "WARNING: mesh '" << m.first << "' has " << m.second.lods.size() << " levels of detail; only the first " << Scene::Drawable::LODCount << " will be used." << std::endl;
+				}
+			}
 		} catch (std::exception &e) {
 			std::cerr << "ERROR loading mesh buffer '" << meshes_file << "': " << e.what() << std::endl;
 			usage = true;
@@ -107,7 +112,7 @@ int main(int argc, char **argv) {
 	if (scene_file != "") {
 		try {
 			scene = new Scene();
-			scene->load(scene_file, [&buffer,&buffer_vao](Scene &scene, Scene::Transform *transform, std::string const &mesh_name){
+			scene->load(scene_file, [&buffer,&buffer_vao](Scene &scene, Scene::Transform transform, std::string const &mesh_name){
 				if (!buffer_vao) return;
 				Mesh const &mesh = buffer->lookup(mesh_name);
 
@@ -121,6 +126,15 @@ int main(int argc, char **argv) {
 				drawable.pipeline.start = mesh.start;
 				drawable.pipeline.count = mesh.count;
 
+				drawable.min = mesh.min;
+				drawable.max = mesh.max;
+
+				for (uint32_t l = 0; l < mesh.lods.size() && l < Scene::Drawable::LODCount; ++l) {
+					drawable.lods[l].start = mesh.lods[l].start;
+					drawable.lods[l].count = mesh.lods[l].count;
+					drawable.lods[l].screen_size = mesh.lods[l].screen_size;
+				}
+
 			});
 		} catch (std::exception &e) {
 			std::cerr << "ERROR loading scene '" << scene_file << "': " << e.what() << std::endl;